@@ -0,0 +1,149 @@
+/* delivery.h
+ * Inbound hand-off from the adaptor's threads to the q main thread.
+ *
+ * Producers push b9 serialised payloads onto a lock-free queue. The q side is
+ * woken through a socketpair registered with sd1, but a wake-up byte is only
+ * written when the q side has parked, so a burst of messages costs a single
+ * wake-up. Once woken, q drains the whole queue as one batch and may then
+ * busy-spin for a bounded time (DeliverySpinMicros) waiting for more before
+ * parking again.
+ *
+ * Notices raised by the adaptor itself (e.g. async send failures) travel the
+ * same channel as events; they are built into a q dictionary
+ * `event`session`id`text on the q side.
+ */
+
+#ifndef KDBFIX_DELIVERY_H
+#define KDBFIX_DELIVERY_H
+
+#include <atomic>
+#include <string>
+#include <kx/k.h>
+
+#include "socketpair.h"
+#include "queue.h"
+#include "stats.h"
+
+struct Delivery
+{
+    std::string function;
+    std::string payload;
+    std::string event;
+    std::string session;
+    std::string text;
+    J id;
+    J enqueued;
+};
+
+static int deliverySockets[2] = { -1, -1 };
+static MpscQueue<Delivery> deliveryQueue;
+static std::atomic<bool> deliveryParked(true);
+static std::atomic<J> deliveryWakeups(0);
+static J deliverySpinNanos = 0;
+static LatencyHistogram deliveryLatency;
+
+static bool StartDelivery(K (*callback)(I))
+{
+    if (deliverySockets[0] != -1)
+        return true;
+    if (dumb_socketpair(deliverySockets, 0) != 0)
+        return false;
+    sd1(deliverySockets[1], callback);
+
+    // flush anything queued before the channel existed (e.g. a replay)
+    char wake = 0;
+    deliveryParked.store(false);
+    send(deliverySockets[0], &wake, 1, 0);
+    return true;
+}
+
+static void PushDelivery(Delivery& delivery)
+{
+    delivery.enqueued = NowNanos();
+    deliveryQueue.push(std::move(delivery));
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (deliveryParked.exchange(false)) {
+        char wake = 0;
+        deliveryWakeups.fetch_add(1, std::memory_order_relaxed);
+        send(deliverySockets[0], &wake, 1, 0);
+    }
+}
+
+static void EnqueueDelivery(const char* function, const char* data, size_t size)
+{
+    Delivery delivery;
+    delivery.function = function;
+    delivery.payload.assign(data, size);
+    delivery.id = 0;
+    PushDelivery(delivery);
+}
+
+static void EnqueueEvent(const char* function, const char* event, const std::string& session, J id, const std::string& text)
+{
+    Delivery delivery;
+    delivery.function = function;
+    delivery.event = event;
+    delivery.session = session;
+    delivery.text = text;
+    delivery.id = id;
+    PushDelivery(delivery);
+}
+
+static K EventToDictionary(const Delivery& delivery)
+{
+    K keys = ktn(KS, 4);
+    K values = ktn(0, 4);
+
+    kS(keys)[0] = ss((S) "event");
+    kS(keys)[1] = ss((S) "session");
+    kS(keys)[2] = ss((S) "id");
+    kS(keys)[3] = ss((S) "text");
+
+    kK(values)[0] = ks((S) delivery.event.c_str());
+    kK(values)[1] = ks((S) delivery.session.c_str());
+    kK(values)[2] = kj(delivery.id);
+    kK(values)[3] = kp((S) delivery.text.c_str());
+
+    return xD(keys, values);
+}
+
+static void DrainDeliveries()
+{
+    char wake[64];
+    while (recv(deliverySockets[1], wake, sizeof(wake), MSG_DONTWAIT) > 0) {}
+
+    Delivery delivery;
+    for (;;) {
+        while (deliveryQueue.pop(delivery)) {
+            deliveryLatency.Record(NowNanos() - delivery.enqueued);
+
+            K r;
+            if (!delivery.event.empty()) {
+                r = k(0, (S) delivery.function.c_str(), EventToDictionary(delivery), (K) 0);
+            } else {
+                K bytes = ktn(KG, (J) delivery.payload.size());
+                memcpy(kG(bytes), delivery.payload.data(), delivery.payload.size());
+                r = k(0, (S) delivery.function.c_str(), d9(bytes), (K) 0);
+                r0(bytes);
+            }
+            if (r != 0) { r0(r); }
+        }
+
+        if (deliverySpinNanos > 0) {
+            J deadline = NowNanos() + deliverySpinNanos;
+            while (deliveryQueue.empty() && NowNanos() < deadline)
+                CPU_RELAX();
+            if (!deliveryQueue.empty())
+                continue;
+        }
+
+        // park, then re-check so a message pushed while parking isn't stranded
+        deliveryParked.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (deliveryQueue.empty() || !deliveryParked.exchange(false))
+            break;
+    }
+}
+
+#endif
@@ -0,0 +1,265 @@
+/* follow.h
+ * Tail-follow a live QuickFIX FileLog messages log.
+ *
+ * A background thread reads the lines appended to the log since the last
+ * saved offset, decodes them against the data dictionary and passes them to
+ * the application's fromApp exactly as .fix.replay does, so they reach q
+ * through the normal batched delivery. inotify wakes the thread when the log
+ * is written to, moved or deleted; rotation (a new inode at the same path)
+ * and truncation (the file shrinking below the offset) restart reading from
+ * the beginning of the new contents.
+ *
+ * The device, inode and offset reached are saved to an offsets file after
+ * every batch, so a restarted follower resumes where it left off instead of
+ * re-reading the whole log.
+ */
+
+#ifndef KDBFIX_FOLLOW_H
+#define KDBFIX_FOLLOW_H
+
+#include <quickfix/Application.h>
+#include <quickfix/DataDictionary.h>
+#include <quickfix/Message.h>
+#include <quickfix/SessionID.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <kx/k.h>
+
+#ifdef __linux__
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/inotify.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+struct Follower
+{
+    std::string logPath;
+    std::string offsetsPath;
+    FIX::DataDictionary* dataDict;
+    FIX::Application* application;
+    std::atomic<bool> running;
+    std::thread* thread;
+};
+
+static std::mutex followersMutex;
+static std::map<std::string, Follower*> followers;
+
+#ifdef __linux__
+struct FollowPosition
+{
+    dev_t device;
+    ino_t inode;
+    off_t offset;
+};
+
+static bool LoadFollowPosition(const std::string& path, FollowPosition& position)
+{
+    std::ifstream in(path);
+    unsigned long long device, inode;
+    long long offset;
+    if (!(in >> device >> inode >> offset))
+        return false;
+    position.device = (dev_t) device;
+    position.inode = (ino_t) inode;
+    position.offset = (off_t) offset;
+    return true;
+}
+
+// write-then-rename so a crash never leaves a torn offsets file
+static void SaveFollowPosition(const std::string& path, const FollowPosition& position)
+{
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << (unsigned long long) position.device << " " << (unsigned long long) position.inode << " " << (long long) position.offset << std::endl;
+        if (!out)
+            return;
+    }
+    rename(tmp.c_str(), path.c_str());
+}
+
+static std::string DirectoryOf(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos)
+        return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+static void DecodeFollowedLine(Follower* follower, const std::string& line)
+{
+    static const FIX::SessionID sessionID;
+    size_t separator = line.rfind(" : ");
+    if (separator == std::string::npos)
+        return;
+    try {
+        FIX::Message message(line.substr(3 + separator), *follower->dataDict, false);
+        follower->application->fromApp(message, sessionID);
+    } catch (std::exception& ex) {
+        std::cout << "follow " << follower->logPath << " - skipping undecodable line: " << ex.what() << std::endl;
+    }
+}
+
+static void FollowLoop(Follower* follower)
+{
+    int notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    int dirWatch = notify < 0 ? -1 : inotify_add_watch(notify, DirectoryOf(follower->logPath).c_str(), IN_CREATE | IN_MOVED_TO);
+    int fileWatch = -1;
+    if (notify < 0 || dirWatch < 0)
+        std::cout << "follow " << follower->logPath << " - inotify unavailable, polling: " << strerror(errno) << std::endl;
+
+    FollowPosition position = { 0, 0, 0 };
+    bool resume = LoadFollowPosition(follower->offsetsPath, position);
+    int fd = -1;
+    std::string partial;
+    char buffer[65536];
+
+    while (follower->running.load()) {
+        struct stat current;
+        bool exists = stat(follower->logPath.c_str(), &current) == 0;
+
+        // rotated: finish the old file first, then move to the new one
+        if (fd >= 0 && exists && (current.st_ino != position.inode || current.st_dev != position.device)) {
+            off_t readFrom = position.offset + (off_t) partial.size();
+            ssize_t n;
+            while ((n = pread(fd, buffer, sizeof(buffer), readFrom)) > 0) {
+                partial.append(buffer, (size_t) n);
+                readFrom += n;
+            }
+            size_t start = 0, end;
+            while ((end = partial.find('\n', start)) != std::string::npos) {
+                DecodeFollowedLine(follower, partial.substr(start, end - start));
+                start = end + 1;
+            }
+            partial.clear();
+            close(fd);
+            fd = -1;
+            if (fileWatch >= 0)
+                inotify_rm_watch(notify, fileWatch);
+            fileWatch = -1;
+        }
+
+        if (fd < 0 && exists) {
+            fd = open(follower->logPath.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd >= 0) {
+                struct stat opened;
+                fstat(fd, &opened);
+                if (!resume || opened.st_ino != position.inode || opened.st_dev != position.device)
+                    position.offset = 0;
+                position.device = opened.st_dev;
+                position.inode = opened.st_ino;
+                resume = false;
+                if (notify >= 0)
+                    fileWatch = inotify_add_watch(notify, follower->logPath.c_str(), IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB);
+            }
+        }
+
+        if (fd >= 0) {
+            struct stat opened;
+            if (fstat(fd, &opened) == 0 && opened.st_size < position.offset) {
+                std::cout << "follow " << follower->logPath << " - truncated, restarting from the beginning" << std::endl;
+                position.offset = 0;
+                partial.clear();
+            }
+
+            // partial holds the bytes of an incomplete last line; offset counts complete lines only
+            off_t readFrom = position.offset + (off_t) partial.size();
+            bool advanced = false;
+            ssize_t n;
+            while (follower->running.load() && (n = pread(fd, buffer, sizeof(buffer), readFrom)) > 0) {
+                readFrom += n;
+                partial.append(buffer, (size_t) n);
+                size_t start = 0, end;
+                while ((end = partial.find('\n', start)) != std::string::npos) {
+                    DecodeFollowedLine(follower, partial.substr(start, end - start));
+                    start = end + 1;
+                }
+                position.offset += (off_t) start;
+                partial.erase(0, start);
+                advanced = advanced || start > 0;
+            }
+            if (advanced)
+                SaveFollowPosition(follower->offsetsPath, position);
+        }
+
+        if (notify >= 0) {
+            struct pollfd pfd = { notify, POLLIN, 0 };
+            if (poll(&pfd, 1, 1000) > 0) {
+                char events[4096];
+                while (read(notify, events, sizeof(events)) > 0) {}
+            }
+        } else {
+            usleep(100000);
+        }
+    }
+
+    if (fd >= 0)
+        close(fd);
+    if (notify >= 0)
+        close(notify);
+    m9();
+}
+#endif
+
+static bool StartFollow(const std::string& dataDictPath, const std::string& logPath, const std::string& offsetsPath, FIX::Application* application)
+{
+#ifdef __linux__
+    std::lock_guard<std::mutex> lock(followersMutex);
+    if (followers.find(logPath) != followers.end())
+        return false;
+
+    FIX::DataDictionary* dataDict;
+    try {
+        std::ifstream dataDictStream(dataDictPath);
+        dataDict = new FIX::DataDictionary(dataDictStream);
+    } catch (std::exception& ex) {
+        std::cout << "unable to load " << dataDictPath << ": " << ex.what() << std::endl;
+        return false;
+    }
+
+    Follower* follower = new Follower;
+    follower->dataDict = dataDict;
+    follower->logPath = logPath;
+    follower->offsetsPath = offsetsPath;
+    follower->application = application;
+    follower->running.store(true);
+    follower->thread = new std::thread(FollowLoop, follower);
+    followers[logPath] = follower;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// the follower finishes the batch it is decoding before stopping
+static bool StopFollow(const std::string& logPath)
+{
+    Follower* follower;
+    {
+        std::lock_guard<std::mutex> lock(followersMutex);
+        auto found = followers.find(logPath);
+        if (found == followers.end())
+            return false;
+        follower = found->second;
+        followers.erase(found);
+    }
+    follower->running.store(false);
+    follower->thread->join();
+    delete follower->thread;
+    delete follower->dataDict;
+    delete follower;
+    return true;
+}
+
+#endif
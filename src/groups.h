@@ -0,0 +1,231 @@
+/* groups.h
+ * Outbound repeating-group encoder driven by the data dictionary.
+ *
+ * Each group's delimiter and field order are taken from the data dictionary
+ * passed to .fix.create and cached per (parent, MsgType, group tag), so the
+ * order of keys in the q dictionaries no longer matters. Groups the
+ * dictionary doesn't know about fall back to the q key order, with the first
+ * key as the delimiter as the FIX spec requires.
+ *
+ * A group may be given as a list of dictionaries, a single dictionary or a
+ * table. Table columns are named by tag number or field name, e.g.
+ * `269`270`271 or `MDEntryType`MDEntryPx`MDEntrySize, and null cells are
+ * left out of the instance. Instances are built in place and handed to
+ * their parent with addGroupPtr rather than copied in.
+ */
+
+#ifndef KDBFIX_GROUPS_H
+#define KDBFIX_GROUPS_H
+
+#include <quickfix/DataDictionary.h>
+#include <quickfix/FieldMap.h>
+#include <quickfix/Group.h>
+#include <quickfix/MessageSorters.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <kx/k.h>
+
+std::string typedtostring(K x);
+
+struct GroupLayout
+{
+    int delim;
+    FIX::message_order order;
+    const FIX::DataDictionary* nested;
+};
+
+// only touched from the q main thread, which builds every outbound message
+static FIX::DataDictionary* groupDictionary = nullptr;
+static std::string groupDictionaryPath;
+static std::map<std::tuple<const FIX::DataDictionary*, std::string, int>, GroupLayout> groupLayouts;
+
+static void LoadGroupDictionary(const std::string& path)
+{
+    if (groupDictionary != nullptr && groupDictionaryPath == path)
+        return;
+    try {
+        FIX::DataDictionary* dictionary = new FIX::DataDictionary(path);
+        delete groupDictionary;
+        groupLayouts.clear();
+        groupDictionary = dictionary;
+        groupDictionaryPath = path;
+    } catch (std::exception& ex) {
+        std::cout << "LoadGroupDictionary - groups will be encoded in key order: " << ex.what() << std::endl;
+    }
+}
+
+// tag numbers are accepted as numbers, or as symbols holding either the number or the field name
+static int ResolveTag(K keys, J i)
+{
+    if (KJ == keys->t)
+        return (int) kJ(keys)[i];
+    if (KI == keys->t)
+        return kI(keys)[i];
+    if (KS == keys->t) {
+        const char* name = kS(keys)[i];
+        char* end;
+        long tag = strtol(name, &end, 10);
+        if (*name != '\0' && *end == '\0')
+            return (int) tag;
+        int found;
+        if (groupDictionary != nullptr && groupDictionary->getFieldTag(name, found))
+            return found;
+        throw std::runtime_error(std::string("unknown field ") + name);
+    }
+    throw std::runtime_error("group keys must be tag numbers or field names");
+}
+
+static const GroupLayout& FindGroupLayout(const FIX::DataDictionary* parent, const std::string& msgType, int groupTag, GroupLayout& fallback, const std::vector<int>& keyOrder)
+{
+    auto key = std::make_tuple(parent, msgType, groupTag);
+    auto found = groupLayouts.find(key);
+    if (found != groupLayouts.end())
+        return found->second;
+
+    int delim;
+    const FIX::DataDictionary* nested;
+    if (parent != nullptr && parent->getGroup(msgType, groupTag, delim, nested)) {
+        // built once here; Groups made from it share the order rather than rebuilding it
+        GroupLayout& layout = groupLayouts[key];
+        layout.delim = delim;
+        layout.nested = nested;
+        layout.order = FIX::message_order(nested->getOrderedFields());
+        return layout;
+    }
+
+    if (keyOrder.empty())
+        throw std::runtime_error("empty group instance for tag " + std::to_string(groupTag));
+    std::vector<int> order(keyOrder);
+    order.push_back(0);
+    fallback.delim = keyOrder.front();
+    fallback.nested = nullptr;
+    fallback.order = FIX::message_order(order.data());
+    return fallback;
+}
+
+static bool IsNullElement(K column, J i)
+{
+    switch (column->t) {
+    case KH: return kH(column)[i] == nh;
+    case KI: return kI(column)[i] == ni;
+    case KJ: return kJ(column)[i] == nj;
+    case KE: return std::isnan(kE(column)[i]);
+    case KF: return std::isnan(kF(column)[i]);
+    case KC: return kC(column)[i] == ' ';
+    case KS: return kS(column)[i][0] == '\0';
+    case KP: return kJ(column)[i] == nj;
+    case KD: case KT: return kI(column)[i] == ni;
+    case 0: return (10 == kK(column)[i]->t || 0 == kK(column)[i]->t) && kK(column)[i]->n == 0;
+    }
+    return false;
+}
+
+static std::string ElementToString(K column, J i)
+{
+    char buffer[32];
+    K atom;
+    switch (column->t) {
+    case 0: return typedtostring(kK(column)[i]);
+    case KB: return kG(column)[i] ? "Y" : "N";
+    case KC: return std::string(1, (char) kC(column)[i]);
+    case KS: return kS(column)[i];
+    case KH: return std::to_string(kH(column)[i]);
+    case KI: return std::to_string(kI(column)[i]);
+    case KJ: return std::to_string(kJ(column)[i]);
+    case KE: snprintf(buffer, sizeof(buffer), "%.7g", kE(column)[i]); return buffer;
+    case KF: snprintf(buffer, sizeof(buffer), "%.15g", kF(column)[i]); return buffer;
+    case KP: atom = ktj(-KP, kJ(column)[i]); break;
+    case KD: atom = kd(kI(column)[i]); break;
+    case KT: atom = kt(kI(column)[i]); break;
+    default: throw std::runtime_error("unsupported column type " + std::to_string((int) column->t));
+    }
+    std::string value = typedtostring(atom);
+    r0(atom);
+    return value;
+}
+
+static void EncodeGroup(FIX::FieldMap& parent, const std::string& msgType, const FIX::DataDictionary* dictionary, int groupTag, K kGroup);
+
+// a nested group is a table, a dictionary or a list of dictionaries
+static bool IsGroupValue(K value)
+{
+    return 98 == value->t || 99 == value->t || (0 == value->t && value->n > 0 && 99 == kK(value)[0]->t);
+}
+
+static void EncodeGroupInstance(FIX::FieldMap& parent, const std::string& msgType, const FIX::DataDictionary* dictionary, int groupTag, K instance)
+{
+    K keys = kK(instance)[0];
+    K values = kK(instance)[1];
+
+    std::vector<int> tags((size_t) keys->n);
+    for (J i = 0; i < keys->n; i++)
+        tags[i] = ResolveTag(keys, i);
+
+    GroupLayout fallback;
+    const GroupLayout& layout = FindGroupLayout(dictionary, msgType, groupTag, fallback, tags);
+    std::unique_ptr<FIX::Group> group(new FIX::Group(groupTag, layout.delim, layout.order));
+    const FIX::DataDictionary* nested = layout.nested;
+
+    for (J i = 0; i < keys->n; i++) {
+        if (0 == values->t && IsGroupValue(kK(values)[i]))
+            EncodeGroup(*group, msgType, nested, tags[i], kK(values)[i]);
+        else
+            group->setField(tags[i], ElementToString(values, i));
+    }
+    parent.addGroupPtr(groupTag, group.release());
+}
+
+static void EncodeGroupTable(FIX::FieldMap& parent, const std::string& msgType, const FIX::DataDictionary* dictionary, int groupTag, K table)
+{
+    K names = kK(table->k)[0];
+    K columns = kK(table->k)[1];
+
+    std::vector<int> tags((size_t) names->n);
+    for (J c = 0; c < names->n; c++)
+        tags[c] = ResolveTag(names, c);
+
+    GroupLayout fallback;
+    const GroupLayout& layout = FindGroupLayout(dictionary, msgType, groupTag, fallback, tags);
+    J rows = names->n > 0 ? kK(columns)[0]->n : 0;
+
+    for (J row = 0; row < rows; row++) {
+        std::unique_ptr<FIX::Group> group(new FIX::Group(groupTag, layout.delim, layout.order));
+        for (J c = 0; c < names->n; c++) {
+            K column = kK(columns)[c];
+            if (0 == column->t && IsGroupValue(kK(column)[row]))
+                EncodeGroup(*group, msgType, layout.nested, tags[c], kK(column)[row]);
+            else if (!IsNullElement(column, row))
+                group->setField(tags[c], ElementToString(column, row));
+        }
+        parent.addGroupPtr(groupTag, group.release());
+    }
+}
+
+static void EncodeGroup(FIX::FieldMap& parent, const std::string& msgType, const FIX::DataDictionary* dictionary, int groupTag, K kGroup)
+{
+    if (98 == kGroup->t) {
+        EncodeGroupTable(parent, msgType, dictionary, groupTag, kGroup);
+    } else if (99 == kGroup->t) {
+        EncodeGroupInstance(parent, msgType, dictionary, groupTag, kGroup);
+    } else if (0 == kGroup->t) {
+        for (J i = 0; i < kGroup->n; i++) {
+            K instance = kK(kGroup)[i];
+            if (99 != instance->t)
+                throw std::runtime_error("group " + std::to_string(groupTag) + " must be a table or a list of dictionaries");
+            EncodeGroupInstance(parent, msgType, dictionary, groupTag, instance);
+        }
+    } else {
+        throw std::runtime_error("group " + std::to_string(groupTag) + " must be a table or a list of dictionaries");
+    }
+}
+
+#endif
@@ -0,0 +1,506 @@
+/* hdb.h
+ * Out-of-core conversion of QuickFIX FileLogs into a date partitioned HDB.
+ *
+ * One reader thread streams the logs in blocks of whole lines to a pool of
+ * decoder threads, one per core. Each decoder parses its block against its
+ * own copy of the data dictionary and produces columns per date and MsgType
+ * in native buffers. The q main thread, which called the converter, takes the
+ * decoded blocks back in file order, builds them into tables and appends them
+ * to hdb/date/MessageName/ with .Q.en, so symbols are enumerated against the
+ * HDB's sym file. The number of blocks in flight is bounded, so memory use
+ * doesn't depend on the size of the logs.
+ *
+ * Each MsgType's table has a time column, from the log line, followed by the
+ * header and body fields the data dictionary lists for that message, in
+ * dictionary order. Repeating groups are represented by their NUMINGROUP
+ * count. Enumerated, currency, exchange and country fields, and the
+ * Symbol and CompIDs, are stored as symbols; other text fields as strings.
+ */
+
+#ifndef KDBFIX_HDB_H
+#define KDBFIX_HDB_H
+
+#include <quickfix/DataDictionary.h>
+#include <quickfix/Message.h>
+
+#include <condition_variable>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pugixml.hpp>
+#include <kx/k.h>
+
+static const size_t HDB_BLOCK_BYTES = 4 << 20;
+
+struct HdbSchema
+{
+    std::string name;
+    std::vector<int> tags;
+    std::vector<std::string> columns;
+    std::vector<char> types;
+    std::unordered_map<int, size_t> positions;
+};
+
+struct HdbColumn
+{
+    std::vector<J> j;
+    std::vector<F> f;
+    std::vector<char> c;
+    std::vector<std::string> s;
+};
+
+struct HdbChunk
+{
+    const HdbSchema* schema;
+    std::vector<J> time;
+    std::vector<HdbColumn> columns;
+
+    HdbChunk() : schema(nullptr) {}
+};
+
+struct HdbBlock
+{
+    J seq;
+    std::string text;
+    std::map<std::pair<I, std::string>, HdbChunk> chunks;
+    J messages;
+    J skipped;
+};
+
+// q type used for a field of the given FIX type
+static char HdbColumnType(int tag, const std::string& fixType, bool enumerated)
+{
+    if (fixType == "FLOAT" || fixType == "PRICE" || fixType == "AMT" || fixType == "QTY"
+        || fixType == "PRICEOFFSET" || fixType == "PERCENTAGE")
+        return 'f';
+    if (fixType == "INT" || fixType == "LENGTH" || fixType == "SEQNUM" || fixType == "NUMINGROUP" || fixType == "DAYOFMONTH")
+        return 'j';
+    if (fixType == "CHAR")
+        return 'c';
+    if (fixType == "BOOLEAN")
+        return 'b';
+    if (fixType == "UTCTIMESTAMP")
+        return 'p';
+    if (fixType == "UTCDATEONLY" || fixType == "UTCDATE" || fixType == "LOCALMKTDATE")
+        return 'd';
+    if (enumerated || fixType == "CURRENCY" || fixType == "EXCHANGE" || fixType == "COUNTRY"
+        || tag == 49 || tag == 56 || tag == 55)
+        return 's';
+    return 'C';
+}
+
+struct HdbField
+{
+    int tag;
+    std::string type;
+    bool enumerated;
+};
+
+static void AddSchemaFields(pugi::xml_node node, const std::map<std::string, pugi::xml_node>& components,
+    const std::map<std::string, HdbField>& fields, HdbSchema& schema)
+{
+    for (pugi::xml_node child = node.first_child(); child; child = child.next_sibling()) {
+        std::string kind = child.name();
+        std::string name = child.attribute("name").value();
+        if (kind == "component") {
+            auto component = components.find(name);
+            if (component != components.end())
+                AddSchemaFields(component->second, components, fields, schema);
+            continue;
+        }
+        if (kind != "field" && kind != "group")
+            continue;
+
+        // groups are named after their NUMINGROUP field, which holds the count
+        auto field = fields.find(name);
+        if (field == fields.end() || schema.positions.count(field->second.tag))
+            continue;
+        int tag = field->second.tag;
+        if (tag == 8 || tag == 9 || tag == 35 || tag == 10)
+            continue;
+        schema.positions[tag] = schema.tags.size();
+        schema.tags.push_back(tag);
+        schema.columns.push_back(name);
+        schema.types.push_back(HdbColumnType(tag, field->second.type, field->second.enumerated));
+    }
+}
+
+static void LoadHdbSchemas(const std::string& path, std::map<std::string, HdbSchema>& schemas)
+{
+    pugi::xml_document doc;
+    if (!doc.load_file(path.c_str()))
+        throw std::runtime_error("XML could not be loaded");
+
+    std::map<std::string, HdbField> fields;
+    for (pugi::xml_node field = doc.child("fix").child("fields").child("field"); field; field = field.next_sibling("field")) {
+        HdbField definition = { field.attribute("number").as_int(), field.attribute("type").value(), (bool) field.child("value") };
+        fields[field.attribute("name").value()] = definition;
+    }
+    std::map<std::string, pugi::xml_node> components;
+    for (pugi::xml_node component = doc.child("fix").child("components").child("component"); component; component = component.next_sibling("component"))
+        components[component.attribute("name").value()] = component;
+
+    for (pugi::xml_node message = doc.child("fix").child("messages").child("message"); message; message = message.next_sibling("message")) {
+        HdbSchema& schema = schemas[message.attribute("msgtype").value()];
+        schema.name = message.attribute("name").value();
+        AddSchemaFields(doc.child("fix").child("header"), components, fields, schema);
+        AddSchemaFields(message, components, fields, schema);
+    }
+}
+
+// days since 2000.01.01 of a proleptic Gregorian date
+static I HdbDays(int year, int month, int day)
+{
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yoe = year - era * 400;
+    int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return (I) (era * 146097 + doe - 719468 - 10957);
+}
+
+static int HdbDigits(const char* s, int n)
+{
+    int value = 0;
+    for (int i = 0; i < n; i++)
+        value = value * 10 + (s[i] - '0');
+    return value;
+}
+
+static bool HdbParseDate(const char* s, size_t n, I& days)
+{
+    if (n < 8)
+        return false;
+    for (int i = 0; i < 8; i++)
+        if (s[i] < '0' || s[i] > '9')
+            return false;
+    days = HdbDays(HdbDigits(s, 4), HdbDigits(s + 4, 2), HdbDigits(s + 6, 2));
+    return true;
+}
+
+// YYYYMMDD-HH:MM:SS with an optional fraction of up to nine digits
+static bool HdbParseTimestamp(const char* s, size_t n, J& nanos)
+{
+    I days;
+    if (n < 17 || !HdbParseDate(s, n, days) || s[8] != '-' || s[11] != ':' || s[14] != ':')
+        return false;
+    J seconds = HdbDigits(s + 9, 2) * 3600 + HdbDigits(s + 12, 2) * 60 + HdbDigits(s + 15, 2);
+    J fraction = 0;
+    size_t digits = 0;
+    if (n > 17 && s[17] == '.') {
+        for (size_t i = 18; i < n && digits < 9 && s[i] >= '0' && s[i] <= '9'; i++, digits++)
+            fraction = fraction * 10 + (s[i] - '0');
+    }
+    for (; digits < 9; digits++)
+        fraction *= 10;
+    nanos = ((J) days * 86400 + seconds) * 1000000000LL + fraction;
+    return true;
+}
+
+static void HdbAppendValue(HdbColumn& column, char type, const std::string& value)
+{
+    I days;
+    J nanos;
+    switch (type) {
+    case 'f': column.f.back() = strtod(value.c_str(), nullptr); break;
+    case 'j': column.j.back() = strtoll(value.c_str(), nullptr, 10); break;
+    case 'p': if (HdbParseTimestamp(value.data(), value.size(), nanos)) column.j.back() = nanos; break;
+    case 'd': if (HdbParseDate(value.data(), value.size(), days)) column.j.back() = days; break;
+    case 'c': column.c.back() = value.empty() ? ' ' : value[0]; break;
+    case 'b': column.c.back() = value == "Y"; break;
+    default: column.s.back() = value; break;
+    }
+}
+
+static void HdbAppendNull(HdbColumn& column, char type)
+{
+    switch (type) {
+    case 'f': column.f.push_back(nf); break;
+    case 'j': case 'p': column.j.push_back(nj); break;
+    case 'd': column.j.push_back(ni); break;
+    case 'c': column.c.push_back(' '); break;
+    case 'b': column.c.push_back(0); break;
+    default: column.s.push_back(std::string()); break;
+    }
+}
+
+static void HdbDecodeLine(const std::map<std::string, HdbSchema>& schemas, const FIX::DataDictionary& dataDict, const char* line, size_t size, HdbBlock& block)
+{
+    std::string text(line, size);
+    size_t separator = text.find(" : ");
+    J nanos;
+    if (separator == std::string::npos || !HdbParseTimestamp(line, separator, nanos)) {
+        block.skipped++;
+        return;
+    }
+
+    FIX::Message message(text.substr(separator + 3), dataDict, false);
+    const FIX::Header& header = message.getHeader();
+    auto found = header.isSetField(35) ? schemas.find(header.getField(35)) : schemas.end();
+    if (found == schemas.end()) {
+        block.skipped++;
+        return;
+    }
+
+    const HdbSchema& schema = found->second;
+    I date = (I) (nanos / 86400000000000LL);
+    HdbChunk& chunk = block.chunks[std::make_pair(date, header.getField(35))];
+    if (chunk.schema == nullptr) {
+        chunk.schema = &schema;
+        chunk.columns.resize(schema.tags.size());
+    }
+
+    chunk.time.push_back(nanos);
+    for (size_t i = 0; i < schema.tags.size(); i++)
+        HdbAppendNull(chunk.columns[i], schema.types[i]);
+
+    const FIX::FieldMap* maps[2] = { &header, &message };
+    for (int m = 0; m < 2; m++) {
+        for (auto it = maps[m]->begin(); it != maps[m]->end(); it++) {
+            auto position = schema.positions.find(it->getTag());
+            if (position != schema.positions.end())
+                HdbAppendValue(chunk.columns[position->second], schema.types[position->second], it->getString());
+        }
+    }
+    block.messages++;
+}
+
+static K HdbColumnToK(const HdbColumn& column, char type, J rows)
+{
+    K x;
+    switch (type) {
+    case 'f': x = ktn(KF, rows); memcpy(kF(x), column.f.data(), rows * sizeof(F)); break;
+    case 'j': x = ktn(KJ, rows); memcpy(kJ(x), column.j.data(), rows * sizeof(J)); break;
+    case 'p': x = ktn(KP, rows); memcpy(kJ(x), column.j.data(), rows * sizeof(J)); break;
+    case 'd': x = ktn(KD, rows); for (J i = 0; i < rows; i++) kI(x)[i] = (I) column.j[i]; break;
+    case 'c': x = ktn(KC, rows); memcpy(kC(x), column.c.data(), rows); break;
+    case 'b': x = ktn(KB, rows); memcpy(kG(x), column.c.data(), rows); break;
+    case 's': x = ktn(KS, rows); for (J i = 0; i < rows; i++) kS(x)[i] = ss((S) column.s[i].c_str()); break;
+    default: x = ktn(0, rows); for (J i = 0; i < rows; i++) kK(x)[i] = kpn((S) column.s[i].data(), (J) column.s[i].size()); break;
+    }
+    return x;
+}
+
+static K HdbChunkToTable(const HdbChunk& chunk)
+{
+    const HdbSchema& schema = *chunk.schema;
+    J rows = (J) chunk.time.size();
+    J n = (J) schema.tags.size() + 1;
+
+    K names = ktn(KS, n);
+    K values = ktn(0, n);
+    kS(names)[0] = ss((S) "time");
+    kK(values)[0] = ktn(KP, rows);
+    memcpy(kJ(kK(values)[0]), chunk.time.data(), rows * sizeof(J));
+    for (size_t i = 0; i < schema.tags.size(); i++) {
+        kS(names)[i + 1] = ss((S) schema.columns[i].c_str());
+        kK(values)[i + 1] = HdbColumnToK(chunk.columns[i], schema.types[i], rows);
+    }
+    return xT(xD(names, values));
+}
+
+class HdbConverter
+{
+    const std::map<std::string, HdbSchema>& schemas;
+    const FIX::DataDictionary& dataDict;
+    std::vector<std::string> logs;
+    size_t maxInFlight;
+
+    std::mutex mutex;
+    std::condition_variable readable;
+    std::condition_variable decoded;
+    std::condition_variable writable;
+    std::deque<HdbBlock*> pending;
+    std::map<J, HdbBlock*> done;
+    J inFlight;
+    J nextSeq;
+    bool finished;
+    bool stopping;
+
+    // hands a block to the decoders, waiting while too many are in flight
+    bool Push(J seq, std::string& text)
+    {
+        HdbBlock* block = new HdbBlock;
+        block->seq = seq;
+        block->messages = 0;
+        block->skipped = 0;
+        block->text.swap(text);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        writable.wait(lock, [this] { return inFlight < (J) maxInFlight || stopping; });
+        if (stopping) {
+            delete block;
+            return false;
+        }
+        inFlight++;
+        pending.push_back(block);
+        readable.notify_one();
+        return true;
+    }
+
+    void Read()
+    {
+        J seq = 0;
+        std::vector<char> buffer(HDB_BLOCK_BYTES);
+        bool ok = true;
+        for (auto it = logs.begin(); it != logs.end() && ok; it++) {
+            int fd = open(it->c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                // the logs were checked before starting, so this one went away since
+                std::cout << "logToHDB - unable to open " << *it << ": " << strerror(errno) << std::endl;
+                std::lock_guard<std::mutex> lock(mutex);
+                missing.push_back(*it);
+                break;
+            }
+
+            std::string carry;
+            for (;;) {
+                ssize_t n = read(fd, buffer.data(), buffer.size());
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0) {
+                    // a log cut short by an I/O error is as incomplete as a missing one
+                    std::cout << "logToHDB - unable to read " << *it << ": " << strerror(errno) << std::endl;
+                    std::lock_guard<std::mutex> lock(mutex);
+                    missing.push_back(*it);
+                    ok = false;
+                    break;
+                }
+                if (n == 0 && carry.empty())
+                    break;
+                std::string text;
+                text.swap(carry);
+                if (n > 0) {
+                    // whole lines only; the rest starts the next block
+                    text.append(buffer.data(), (size_t) n);
+                    size_t end = text.rfind('\n');
+                    if (end == std::string::npos) {
+                        carry.swap(text);
+                        continue;
+                    }
+                    carry.assign(text, end + 1, std::string::npos);
+                    text.resize(end + 1);
+                } else {
+                    text.push_back('\n');
+                }
+                if (!(ok = Push(seq++, text)) || n <= 0)
+                    break;
+            }
+            close(fd);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        readable.notify_all();
+        decoded.notify_all();
+    }
+
+    void Decode()
+    {
+        FIX::DataDictionary localDict(dataDict);
+        for (;;) {
+            HdbBlock* block;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                readable.wait(lock, [this] { return !pending.empty() || finished || stopping; });
+                if (pending.empty() || stopping)
+                    return;
+                block = pending.front();
+                pending.pop_front();
+            }
+
+            const char* text = block->text.c_str();
+            size_t start = 0, end;
+            while ((end = block->text.find('\n', start)) != std::string::npos) {
+                if (end > start) {
+                    try {
+                        HdbDecodeLine(schemas, localDict, text + start, end - start, *block);
+                    } catch (std::exception&) {
+                        block->skipped++;
+                    }
+                }
+                start = end + 1;
+            }
+            std::string().swap(block->text);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            done[block->seq] = block;
+            decoded.notify_all();
+        }
+    }
+
+    public:
+    J messages;
+    J skipped;
+    std::vector<std::string> missing;
+
+    HdbConverter(const std::map<std::string, HdbSchema>& schemas, const FIX::DataDictionary& dataDict, const std::vector<std::string>& logs, size_t maxInFlight)
+        : schemas(schemas), dataDict(dataDict), logs(logs), maxInFlight(maxInFlight),
+          inFlight(0), nextSeq(0), finished(false), stopping(false), messages(0), skipped(0) {}
+
+    // runs on the q main thread, which does all the writing; returns a q error or null
+    K Run(K hdb, size_t decoders)
+    {
+        std::thread reader(&HdbConverter::Read, this);
+        std::vector<std::thread> pool;
+        for (size_t i = 0; i < decoders; i++)
+            pool.push_back(std::thread(&HdbConverter::Decode, this));
+
+        K error = (K) 0;
+        for (;;) {
+            HdbBlock* block;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                decoded.wait(lock, [this] { return done.count(nextSeq) || (finished && inFlight == 0); });
+                if (!done.count(nextSeq))
+                    break;
+                block = done[nextSeq];
+                done.erase(nextSeq++);
+            }
+
+            messages += block->messages;
+            skipped += block->skipped;
+            for (auto it = block->chunks.begin(); it != block->chunks.end() && error == 0; it++) {
+                K r = k(0, (S) "{[h;d;t;x] .[` sv .Q.par[h;d;t],`;();,;.Q.en[h] x]}",
+                    r1(hdb), kd(it->first.first), ks((S) it->second.schema->name.c_str()), HdbChunkToTable(it->second), (K) 0);
+                if (r != 0 && r->t == -128)
+                    error = krr(ss(r->s));
+                if (r != 0)
+                    r0(r);
+            }
+            delete block;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            inFlight--;
+            if (error != 0)
+                stopping = true;
+            writable.notify_one();
+            readable.notify_all();
+            if (error != 0)
+                break;
+        }
+
+        reader.join();
+        for (auto it = pool.begin(); it != pool.end(); it++)
+            it->join();
+        for (auto it = pending.begin(); it != pending.end(); it++)
+            delete *it;
+        for (auto it = done.begin(); it != done.end(); it++)
+            delete it->second;
+        return error;
+    }
+};
+
+#endif
@@ -0,0 +1,212 @@
+/* history.h
+ * Bounded, indexed history of recent inbound messages per session.
+ *
+ * Messages are kept in arrival order in a ring (a deque trimmed from the
+ * front) as the b9 payload already built for the hand-off to q, and are only
+ * turned back into q dictionaries when looked up. Configured per session in
+ * the session settings file:
+ *
+ *   HistoryMaxMessages=<n>        keep at most n messages
+ *   HistoryMaxBytes=<bytes>       keep at most this many payload bytes
+ *   HistoryIndexTags=11,37,17     tags to hash-index for lookups by value
+ *
+ * MsgSeqNum (34) is always indexed, for both range queries and lookups.
+ * Setting either limit enables the history for a session.
+ */
+
+#ifndef KDBFIX_HISTORY_H
+#define KDBFIX_HISTORY_H
+
+#include <quickfix/Message.h>
+#include <quickfix/SessionSettings.h>
+#include <quickfix/SessionID.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <kx/k.h>
+
+class SessionHistory
+{
+    struct Entry
+    {
+        J id;
+        J seq;
+        std::string payload;
+        std::vector<std::pair<int, std::string> > keys;
+    };
+
+    std::mutex mutex;
+    std::deque<Entry> entries;
+    std::vector<int> indexTags;
+    std::unordered_map<int, std::unordered_map<std::string, std::deque<J> > > indexes;
+    std::multimap<J, J> bySeq;
+    J nextId;
+    J bytes;
+    J maxMessages;
+    J maxBytes;
+
+    // ids are assigned in arrival order, so an id's position in the ring is its offset from the front
+    const Entry& EntryOf(J id) const { return entries[(size_t) (id - entries.front().id)]; }
+
+    void EvictOldest()
+    {
+        const Entry& oldest = entries.front();
+        for (auto it = oldest.keys.begin(); it != oldest.keys.end(); it++) {
+            auto& index = indexes.find(it->first)->second;
+            auto found = index.find(it->second);
+            if (found == index.end())
+                continue;
+            if (!found->second.empty() && found->second.front() == oldest.id)
+                found->second.pop_front();
+            if (found->second.empty())
+                index.erase(found);
+        }
+        auto range = bySeq.equal_range(oldest.seq);
+        for (auto it = range.first; it != range.second; it++) {
+            if (it->second == oldest.id) {
+                bySeq.erase(it);
+                break;
+            }
+        }
+        bytes -= (J) oldest.payload.size();
+        entries.pop_front();
+    }
+
+    public:
+    SessionHistory(J maxMessages, J maxBytes, const std::vector<int>& indexTags)
+        : indexTags(indexTags), nextId(0), bytes(0), maxMessages(maxMessages), maxBytes(maxBytes)
+    {
+        for (auto it = indexTags.begin(); it != indexTags.end(); it++)
+            indexes[*it];
+    }
+
+    void Record(const FIX::Message& message, const char* data, size_t size)
+    {
+        Entry entry;
+        entry.payload.assign(data, size);
+        const FIX::Header& header = message.getHeader();
+        entry.seq = header.isSetField(34) ? atoll(header.getField(34).c_str()) : nj;
+        for (auto it = indexTags.begin(); it != indexTags.end(); it++) {
+            if (message.isSetField(*it))
+                entry.keys.push_back(std::make_pair(*it, message.getField(*it)));
+            else if (header.isSetField(*it))
+                entry.keys.push_back(std::make_pair(*it, header.getField(*it)));
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        entry.id = nextId++;
+        for (auto it = entry.keys.begin(); it != entry.keys.end(); it++)
+            indexes.find(it->first)->second[it->second].push_back(entry.id);
+        bySeq.insert(std::make_pair(entry.seq, entry.id));
+        bytes += (J) entry.payload.size();
+        entries.push_back(std::move(entry));
+
+        while (!entries.empty() &&
+               ((maxMessages > 0 && (J) entries.size() > maxMessages) || (maxBytes > 0 && bytes > maxBytes)))
+            EvictOldest();
+    }
+
+    bool Lookup(int tag, const std::string& value, std::vector<std::string>& payloads)
+    {
+        // MsgSeqNum is answered from the sequence index unless it was also hash-indexed
+        if (tag == 34 && indexes.find(tag) == indexes.end()) {
+            char* end;
+            J seq = strtoll(value.c_str(), &end, 10);
+            if (!value.empty() && *end == '\0')
+                Range(seq, seq, payloads);
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto index = indexes.find(tag);
+        if (index == indexes.end())
+            return false;
+        auto found = index->second.find(value);
+        if (found != index->second.end()) {
+            for (auto it = found->second.begin(); it != found->second.end(); it++)
+                payloads.push_back(EntryOf(*it).payload);
+        }
+        return true;
+    }
+
+    void Range(J fromSeq, J toSeq, std::vector<std::string>& payloads)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<J> ids;
+        for (auto it = bySeq.lower_bound(fromSeq); it != bySeq.end() && it->first <= toSeq; it++)
+            ids.push_back(it->second);
+        std::sort(ids.begin(), ids.end());
+        for (auto it = ids.begin(); it != ids.end(); it++)
+            payloads.push_back(EntryOf(*it).payload);
+    }
+};
+
+static std::mutex historiesMutex;
+static std::map<std::string, SessionHistory*> histories;
+
+static std::vector<int> ParseTagList(const std::string& tags)
+{
+    std::vector<int> parsed;
+    std::stringstream stream(tags);
+    std::string tag;
+    while (std::getline(stream, tag, ','))
+        if (!tag.empty())
+            parsed.push_back(atoi(tag.c_str()));
+    return parsed;
+}
+
+static void LoadHistorySettings(const FIX::SessionSettings& settings)
+{
+    std::set<FIX::SessionID> sessions = settings.getSessions();
+    for (auto it = sessions.begin(); it != sessions.end(); it++) {
+        try {
+            const FIX::Dictionary& dict = settings.get(*it);
+            J maxMessages = dict.has("HistoryMaxMessages") ? dict.getInt("HistoryMaxMessages") : 0;
+            J maxBytes = dict.has("HistoryMaxBytes") ? (J) dict.getDouble("HistoryMaxBytes") : 0;
+            if (maxMessages <= 0 && maxBytes <= 0)
+                continue;
+            std::vector<int> indexTags;
+            if (dict.has("HistoryIndexTags"))
+                indexTags = ParseTagList(dict.getString("HistoryIndexTags"));
+
+            std::lock_guard<std::mutex> lock(historiesMutex);
+            if (histories.find(it->toString()) == histories.end())
+                histories[it->toString()] = new SessionHistory(maxMessages, maxBytes, indexTags);
+        } catch (std::exception& ex) {
+            std::cout << "LoadHistorySettings - ignoring settings for " << it->toString() << ": " << ex.what() << std::endl;
+        }
+    }
+}
+
+static SessionHistory* FindHistory(const std::string& session)
+{
+    std::lock_guard<std::mutex> lock(historiesMutex);
+    auto found = histories.find(session);
+    return found == histories.end() ? nullptr : found->second;
+}
+
+// decode payloads copied out of a history on the q main thread
+static K PayloadsToK(const std::vector<std::string>& payloads)
+{
+    K result = ktn(0, 0);
+    for (auto it = payloads.begin(); it != payloads.end(); it++) {
+        K bytes = ktn(KG, (J) it->size());
+        memcpy(kG(bytes), it->data(), it->size());
+        jk(&result, d9(bytes));
+        r0(bytes);
+    }
+    return result;
+}
+
+#endif
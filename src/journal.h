@@ -0,0 +1,337 @@
+/* journal.h
+ * Append-only journal of inbound messages in kdb+ log format.
+ *
+ * Every message handed to q is also queued for a background writer thread
+ * which appends it to the journal as a (`.fix.onRecv;msg) entry, so that
+ * -11!`:journal replays the day through the normal callback. The b9 payload
+ * produced for the hand-off is reused; only its IPC header is replaced.
+ *
+ * Configured from the DEFAULT block of the session settings file:
+ *
+ *   JournalPath=<file>                 enable journaling to this file
+ *   JournalGroupCommitMicros=<usecs>   wait up to this long to batch writes
+ *   JournalFsyncMillis=<millis>        fdatasync at most this often, 0 after
+ *                                      every group commit; unset never syncs
+ *
+ * A journal left with a torn last entry by a crash is truncated back to its
+ * last complete entry when it is reopened, so that new entries stay reachable
+ * by -11!. At exit the writer drains its queue and syncs before stopping.
+ */
+
+#ifndef KDBFIX_JOURNAL_H
+#define KDBFIX_JOURNAL_H
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <kx/k.h>
+
+#include "queue.h"
+#include "stats.h"
+
+// size of the IPC header b9 puts in front of a serialised object
+static const size_t IPC_HEADER_SIZE = 8;
+
+// serialised body (no IPC header) of the list (`function;payload)
+static std::string BuildCallBytes(const std::string& function, const std::string& payload)
+{
+    std::string bytes;
+    bytes.reserve(7 + function.size() + payload.size());
+
+    I count = 2;
+    bytes.push_back((char) 0);
+    bytes.push_back((char) 0);
+    bytes.append((const char*) &count, sizeof(I));
+    bytes.push_back((char) -KS);
+    bytes.append(function.c_str(), function.size() + 1);
+    bytes.append(payload, IPC_HEADER_SIZE, std::string::npos);
+
+    return bytes;
+}
+
+struct JournalEntry
+{
+    std::string function;
+    std::string payload;
+};
+
+static MpscQueue<JournalEntry> journalQueue;
+static Parker journalParker;
+static std::thread* journalThread = nullptr;
+static std::atomic<bool> journalRunning(false);
+
+static bool JournalEnabled()
+{
+    return journalThread != nullptr;
+}
+
+static void JournalAppend(const char* function, const char* data, size_t size)
+{
+    JournalEntry entry;
+    entry.function = function;
+    entry.payload.assign(data, size);
+    journalQueue.push(std::move(entry));
+    journalParker.Unpark();
+}
+
+static bool WriteFully(int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        size -= (size_t) written;
+    }
+    return true;
+}
+
+// bytes taken by the serialised object at p, or 0 if it is cut short or malformed
+static size_t SerialisedSize(const unsigned char* p, size_t avail, int depth)
+{
+    // element widths by type; 0 for types that aren't fixed width
+    static const size_t widths[20] = { 0, 1, 16, 0, 1, 2, 4, 8, 4, 8, 1, 0, 8, 4, 4, 8, 8, 4, 4, 4 };
+    if (avail < 1 || depth > 64)
+        return 0;
+
+    signed char t = (signed char) p[0];
+    if (t == -KS || t == -128) {
+        const unsigned char* end = (const unsigned char*) memchr(p + 1, 0, avail - 1);
+        return end == nullptr ? 0 : (size_t) (end - p) + 1;
+    }
+    if (t < 0 && t >= -19 && t != -3) {
+        size_t size = 1 + widths[-t];
+        return size <= avail ? size : 0;
+    }
+    if (t >= 0 && t <= 19 && t != 3) {
+        if (avail < 6)
+            return 0;
+        I n;
+        memcpy(&n, p + 2, sizeof(I));
+        if (n < 0)
+            return 0;
+        size_t size = 6;
+        if (t == 0 || t == KS) {
+            for (I i = 0; i < n; i++) {
+                size_t item;
+                if (t == 0) {
+                    item = SerialisedSize(p + size, avail - size, depth + 1);
+                } else {
+                    const unsigned char* end = (const unsigned char*) memchr(p + size, 0, avail - size);
+                    item = end == nullptr ? 0 : (size_t) (end - p) - size + 1;
+                }
+                if (item == 0)
+                    return 0;
+                size += item;
+            }
+            return size;
+        }
+        size += (size_t) n * widths[t];
+        return size <= avail ? size : 0;
+    }
+    if (t == 98) {
+        size_t dict = avail < 2 ? 0 : SerialisedSize(p + 2, avail - 2, depth + 1);
+        return dict == 0 ? 0 : dict + 2;
+    }
+    if (t == 99 || t == 127) {
+        size_t keys = SerialisedSize(p + 1, avail - 1, depth + 1);
+        size_t values = keys == 0 ? 0 : SerialisedSize(p + 1 + keys, avail - 1 - keys, depth + 1);
+        return values == 0 ? 0 : 1 + keys + values;
+    }
+    if (t == 101)
+        return avail >= 2 ? 2 : 0;
+    return 0;
+}
+
+// cut a torn last entry off an existing log and make its count match what's left
+static bool RepairJournal(int fd, const std::string& path, off_t dataStart, J& count, off_t countOffset, bool wideCount)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return false;
+    if (st.st_size <= dataStart)
+        return true;
+
+    void* mapped = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED)
+        return false;
+    const unsigned char* data = (const unsigned char*) mapped;
+    size_t end = (size_t) dataStart, size = (size_t) st.st_size;
+    J entries = 0;
+    for (size_t entry; end < size && (entry = SerialisedSize(data + end, size - end, 0)) != 0; end += entry)
+        entries++;
+    munmap(mapped, (size_t) st.st_size);
+
+    if (end < size) {
+        std::cout << "journal " << path << " has a torn tail, truncating " << size - end << " bytes after entry " << entries << std::endl;
+        if (ftruncate(fd, (off_t) end) != 0)
+            return false;
+    }
+    if (entries != count) {
+        count = entries;
+        I narrow = (I) count;
+        bool ok = wideCount ? pwrite(fd, &count, sizeof(J), countOffset) == (ssize_t) sizeof(J)
+                            : pwrite(fd, &narrow, sizeof(I), countOffset) == (ssize_t) sizeof(I);
+        if (!ok)
+            return false;
+    }
+    return fdatasync(fd) == 0;
+}
+
+// open (or create) a kdb+ log for appending, reading the entry count from its header
+static int OpenJournal(const std::string& path, J& count, off_t& countOffset, bool& wideCount)
+{
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return -1;
+
+    unsigned char header[16];
+    ssize_t n = pread(fd, header, sizeof(header), 0);
+    if (n <= 0) {
+        // new log: 0xff01, type 0, attr 0, 32-bit count
+        const unsigned char empty[8] = { 0xff, 0x01, 0, 0, 0, 0, 0, 0 };
+        if (!WriteFully(fd, (const char*) empty, sizeof(empty))) {
+            close(fd);
+            return -1;
+        }
+        count = 0;
+        countOffset = 4;
+        wideCount = false;
+    } else if (n >= 8 && header[0] == 0xff && header[1] == 0x01) {
+        I narrow;
+        memcpy(&narrow, &header[4], sizeof(I));
+        count = narrow;
+        countOffset = 4;
+        wideCount = false;
+        if (!RepairJournal(fd, path, 8, count, countOffset, wideCount)) {
+            close(fd);
+            return -1;
+        }
+    } else if (n >= 16 && header[0] == 0xfe && header[1] == 0x20) {
+        memcpy(&count, &header[8], sizeof(J));
+        countOffset = 8;
+        wideCount = true;
+        if (!RepairJournal(fd, path, 16, count, countOffset, wideCount)) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (lseek(fd, 0, SEEK_END) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void JournalLoop(int fd, std::string path, J count, off_t countOffset, bool wideCount, J groupCommitNanos, J fsyncNanos)
+{
+    std::string group;
+    J lastSync = NowNanos();
+    bool dirty = false;
+    JournalEntry entry;
+
+    for (;;) {
+        group.clear();
+        J entries = 0;
+        J deadline = 0;
+        for (;;) {
+            while (journalQueue.pop(entry)) {
+                if (entries++ == 0)
+                    deadline = NowNanos() + groupCommitNanos;
+                group += BuildCallBytes(entry.function, entry.payload);
+            }
+            if (entries == 0 || NowNanos() >= deadline)
+                break;
+            CPU_RELAX();
+        }
+
+        if (entries == 0 && !journalRunning.load()) {
+            // stopping with nothing left queued
+            if (fdatasync(fd) != 0)
+                std::cout << "unable to sync journal " << path << ": " << strerror(errno) << std::endl;
+            close(fd);
+            return;
+        }
+
+        if (entries == 0) {
+            // sync the tail of a burst once the journal goes idle
+            if (dirty && NowNanos() - lastSync >= fsyncNanos) {
+                fdatasync(fd);
+                lastSync = NowNanos();
+                dirty = false;
+            }
+            journalParker.Wait([] { return !journalQueue.empty() || !journalRunning.load(); },
+                std::chrono::microseconds(0), std::chrono::milliseconds(100));
+            continue;
+        }
+
+        count += entries;
+        bool ok = WriteFully(fd, group.data(), group.size());
+        if (ok && wideCount)
+            ok = pwrite(fd, &count, sizeof(J), countOffset) == (ssize_t) sizeof(J);
+        else if (ok) {
+            I narrow = (I) count;
+            ok = pwrite(fd, &narrow, sizeof(I), countOffset) == (ssize_t) sizeof(I);
+        }
+        dirty = ok && fsyncNanos >= 0;
+        if (dirty && NowNanos() - lastSync >= fsyncNanos) {
+            ok = fdatasync(fd) == 0;
+            lastSync = NowNanos();
+            dirty = false;
+        }
+        if (!ok)
+            std::cout << "unable to write journal " << path << ": " << strerror(errno) << std::endl;
+    }
+}
+
+// writes out and syncs everything queued before returning
+static void StopJournal()
+{
+    if (journalThread == nullptr)
+        return;
+    journalRunning.store(false);
+    journalParker.Unpark();
+    journalThread->join();
+    delete journalThread;
+    journalThread = nullptr;
+}
+
+// fsyncNanos < 0 leaves syncing to the OS
+static bool StartJournal(const std::string& path, J groupCommitNanos, J fsyncNanos)
+{
+    if (journalThread != nullptr)
+        return true;
+
+    J count = 0;
+    off_t countOffset = 0;
+    bool wideCount = false;
+    int fd = OpenJournal(path, count, countOffset, wideCount);
+    if (fd < 0) {
+        std::cout << "unable to open journal " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    journalRunning.store(true);
+    journalThread = new std::thread(JournalLoop, fd, path, count, countOffset, wideCount, groupCommitNanos, fsyncNanos);
+    atexit(StopJournal);
+    return true;
+}
+
+#endif
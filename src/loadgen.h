@@ -0,0 +1,268 @@
+/* loadgen.h
+ * Replays a recorded FIX log into a live session as load.
+ *
+ * An encoder thread reads the log ahead of the sender, keeping a bounded
+ * queue of ready-built messages: application messages sent by the chosen
+ * CompID, readdressed to the target session with their MsgSeqNum and
+ * SendingTime removed so that the session assigns fresh ones. A sender
+ * thread waits for the session to log on and then sends each message at
+ * its original offset from the first, divided by the speed, or as fast as
+ * possible when the speed is 0.
+ *
+ * The time spent in Session::send (sequencing, store persistence and the
+ * socket write) is recorded per message, along with how far the sender fell
+ * behind the schedule. Completion is reported to .fix.onEvent. Replayed
+ * messages are kept out of the order-state cache.
+ */
+
+#ifndef KDBFIX_LOADGEN_H
+#define KDBFIX_LOADGEN_H
+
+#include <quickfix/DataDictionary.h>
+#include <quickfix/Message.h>
+#include <quickfix/Session.h>
+#include <quickfix/SessionID.h>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <kx/k.h>
+
+#include "delivery.h"
+#include "hdb.h"
+#include "queue.h"
+#include "stats.h"
+
+enum LoadState { LOAD_IDLE, LOAD_WAITING, LOAD_RUNNING, LOAD_DONE, LOAD_STOPPED, LOAD_FAILED };
+
+struct LoadMessage
+{
+    FIX::Message* message;
+    J offset;
+};
+
+static const J LOAD_QUEUE_DEPTH = 16384;
+
+static MpscQueue<LoadMessage> loadQueue;
+static std::atomic<J> loadQueued(0);
+static Parker loadParker;
+static std::thread* loadEncoder = nullptr;
+static std::thread* loadSender = nullptr;
+static std::atomic<bool> loadRunning(false);
+static std::atomic<bool> loadEncoded(false);
+static std::atomic<int> loadState(LOAD_IDLE);
+static std::atomic<J> loadSent(0);
+static std::atomic<J> loadFailed(0);
+static std::atomic<J> loadSkipped(0);
+static std::atomic<J> loadStart(0);
+static std::atomic<J> loadEnd(0);
+static std::atomic<J> loadMaxLag(0);
+static LatencyHistogram loadLatency;
+
+// set on the load sender so toApp can tell replayed messages from real order flow
+static thread_local bool loadSenderThread = false;
+
+static void LoadEncodeLoop(FIX::DataDictionary* dataDict, std::string logPath, FIX::SessionID sessionID, std::string origSender)
+{
+    std::ifstream log(logPath);
+    std::string line;
+    J first = nj;
+
+    while (loadRunning.load() && std::getline(log, line)) {
+        size_t separator = line.find(" : ");
+        J recorded;
+        if (separator == std::string::npos || !HdbParseTimestamp(line.data(), separator, recorded)) {
+            loadSkipped.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        FIX::Message* message;
+        try {
+            message = new FIX::Message(line.substr(separator + 3), *dataDict, false);
+        } catch (std::exception&) {
+            loadSkipped.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // the session generates its own admin traffic
+        FIX::Header& header = message->getHeader();
+        if (message->isAdmin() || (!origSender.empty() && (!header.isSetField(49) || header.getField(49) != origSender))) {
+            delete message;
+            continue;
+        }
+        header.setField(sessionID.getBeginString());
+        header.setField(sessionID.getSenderCompID());
+        header.setField(sessionID.getTargetCompID());
+        header.removeField(34);
+        header.removeField(52);
+        header.removeField(43);
+        header.removeField(97);
+        header.removeField(122);
+
+        if (first == nj)
+            first = recorded;
+        LoadMessage load = { message, recorded - first };
+        while (loadRunning.load() && loadQueued.load() >= LOAD_QUEUE_DEPTH)
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        loadQueued.fetch_add(1);
+        loadQueue.push(load);
+        loadParker.Unpark();
+    }
+
+    delete dataDict;
+    loadEncoded.store(true);
+    loadParker.Unpark();
+}
+
+static void LoadSendLoop(FIX::SessionID sessionID, double speed)
+{
+    loadSenderThread = true;
+    FIX::Session* session = FIX::Session::lookupSession(sessionID);
+    if (session == nullptr)
+        loadRunning.store(false);
+    while (session != nullptr && loadRunning.load() && !session->isLoggedOn())
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    if (session != nullptr && loadRunning.load()) {
+        loadState.store(LOAD_RUNNING);
+        J start = NowNanos();
+        loadStart.store(start);
+
+        LoadMessage load;
+        for (;;) {
+            if (!loadQueue.pop(load)) {
+                if ((!loadRunning.load() || loadEncoded.load()) && loadQueue.empty())
+                    break;
+                loadParker.Wait([] { return !loadQueue.empty() || loadEncoded.load() || !loadRunning.load(); },
+                    std::chrono::microseconds(50), std::chrono::milliseconds(100));
+                continue;
+            }
+            loadQueued.fetch_sub(1);
+            if (!loadRunning.load()) {
+                delete load.message;
+                continue;
+            }
+
+            // sleep until just before the message is due, then spin
+            if (speed > 0) {
+                J due = start + (J) (load.offset / speed);
+                J now;
+                while ((now = NowNanos()) < due) {
+                    if (due - now > 200000)
+                        std::this_thread::sleep_for(std::chrono::nanoseconds(due - now - 100000));
+                    else
+                        CPU_RELAX();
+                }
+                if (now - due > loadMaxLag.load())
+                    loadMaxLag.store(now - due);
+            }
+
+            J before = NowNanos();
+            bool sent = false;
+            try {
+                sent = session->send(*load.message);
+            } catch (std::exception&) {
+            }
+            loadLatency.Record(NowNanos() - before);
+            (sent ? loadSent : loadFailed).fetch_add(1, std::memory_order_relaxed);
+            delete load.message;
+        }
+        loadEnd.store(NowNanos());
+    } else {
+        // drain whatever the encoder managed to queue
+        LoadMessage load;
+        while (!loadEncoded.load() || !loadQueue.empty()) {
+            while (loadQueue.pop(load)) {
+                loadQueued.fetch_sub(1);
+                delete load.message;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    if (session == nullptr) {
+        loadState.store(LOAD_FAILED);
+        EnqueueEvent(".fix.onEvent", "loadFailed", sessionID.toString(), 0, "session not found");
+    } else if (!loadRunning.load()) {
+        loadState.store(LOAD_STOPPED);
+        EnqueueEvent(".fix.onEvent", "loadStopped", sessionID.toString(), loadSent.load(), "");
+    } else {
+        loadState.store(LOAD_DONE);
+        EnqueueEvent(".fix.onEvent", "loadDone", sessionID.toString(), loadSent.load(), "");
+    }
+}
+
+static void StopLoad()
+{
+    if (loadSender == nullptr)
+        return;
+    loadRunning.store(false);
+    loadParker.Unpark();
+    loadEncoder->join();
+    loadSender->join();
+    delete loadEncoder;
+    delete loadSender;
+    loadEncoder = nullptr;
+    loadSender = nullptr;
+}
+
+// one load at a time; a finished load is cleaned up by the next
+static bool StartLoad(FIX::DataDictionary* dataDict, const std::string& logPath, const FIX::SessionID& sessionID, double speed, const std::string& origSender)
+{
+    int state = loadState.load();
+    if (state == LOAD_WAITING || state == LOAD_RUNNING)
+        return false;
+    StopLoad();
+
+    // the encoder may have queued one more message as the last load stopped
+    LoadMessage stale;
+    while (loadQueue.pop(stale))
+        delete stale.message;
+    loadQueued.store(0);
+
+    loadRunning.store(true);
+    loadEncoded.store(false);
+    loadState.store(LOAD_WAITING);
+    loadSent.store(0);
+    loadFailed.store(0);
+    loadSkipped.store(0);
+    loadStart.store(0);
+    loadEnd.store(0);
+    loadMaxLag.store(0);
+    loadLatency.Reset();
+
+    loadEncoder = new std::thread(LoadEncodeLoop, dataDict, logPath, sessionID, origSender);
+    loadSender = new std::thread(LoadSendLoop, sessionID, speed);
+    return true;
+}
+
+static K LoadStatsToDictionary()
+{
+    static const char* states[] = { "idle", "waiting", "running", "done", "stopped", "failed" };
+    K stats = loadLatency.ToDictionary();
+
+    J start = loadStart.load();
+    J end = loadEnd.load() != 0 ? loadEnd.load() : NowNanos();
+    J elapsed = start != 0 ? end - start : 0;
+    J sent = loadSent.load();
+
+    js(&kK(stats)[0], ss((S) "state"));
+    jk(&kK(stats)[1], ks((S) states[loadState.load()]));
+    js(&kK(stats)[0], ss((S) "sent"));
+    jk(&kK(stats)[1], kj(sent));
+    js(&kK(stats)[0], ss((S) "failed"));
+    jk(&kK(stats)[1], kj(loadFailed.load()));
+    js(&kK(stats)[0], ss((S) "skipped"));
+    jk(&kK(stats)[1], kj(loadSkipped.load()));
+    js(&kK(stats)[0], ss((S) "elapsed"));
+    jk(&kK(stats)[1], ktj(-KN, elapsed));
+    js(&kK(stats)[0], ss((S) "rate"));
+    jk(&kK(stats)[1], kf(elapsed > 0 ? sent * 1e9 / elapsed : 0));
+    js(&kK(stats)[0], ss((S) "maxLag"));
+    jk(&kK(stats)[1], ktj(-KN, loadMaxLag.load()));
+    return stats;
+}
+
+#endif
@@ -16,8 +16,19 @@
 #include <quickfix/DataDictionary.h>
 #include <quickfix/SessionID.h>
 
-#include "socketpair.h"
 #include <kx/k.h>
+#include "delivery.h"
+#include "tuning.h"
+#include "sender.h"
+#include "journal.h"
+#include "history.h"
+#include "orders.h"
+#include "follow.h"
+#include "publish.h"
+#include "groups.h"
+#include "routes.h"
+#include "hdb.h"
+#include "loadgen.h"
 
 #include <config.h>
 #include <string.h>
@@ -35,6 +46,8 @@
 #include <iomanip>
 #include <algorithm>
 #include <fstream>
+#include <memory>
+#include <mutex>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdeprecated"
@@ -43,11 +56,17 @@ std::string typeconvert(std::string s);
 std::string typedtostring(K x);
 void CreateFIXMaps(K dataDictFile);
 K convertmsgtype(std::string field, std::string type);
-std::set<int> repeatingGroupTags;
-std::unordered_map<int,std::string> typemap;
 
-
-int sockets[2];
+// types of every loaded dictionary's fields; replaced whole when another
+// dictionary is loaded, and read as one snapshot per converted message
+struct FIXMaps
+{
+    std::set<int> repeatingGroupTags;
+    std::unordered_map<int,std::string> typemap;
+    std::set<std::string> dictionaries;
+};
+static std::mutex fixMapsMutex;
+static std::shared_ptr<const FIXMaps> fixMaps = std::make_shared<const FIXMaps>();
 
 class FixEngineApplication : public FIX::Application
 {
@@ -63,20 +82,21 @@ class FixEngineApplication : public FIX::Application
         throw (FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::UnsupportedMessageType);
 };
 
-static void addFIXAtomsToKDict(FIX::FieldMap::Fields::const_iterator begin, FIX::FieldMap::Fields::const_iterator end, K* keys, K* values)
+static void addFIXAtomsToKDict(const FIXMaps& maps, FIX::FieldMap::Fields::const_iterator begin, FIX::FieldMap::Fields::const_iterator end, K* keys, K* values)
 {
     for (auto it = begin; it != end; it++) {
         J tag = (J) it->getTag();
-        if (repeatingGroupTags.find(tag) == repeatingGroupTags.end()){
+        if (maps.repeatingGroupTags.find(tag) == maps.repeatingGroupTags.end()){
             ja(keys, &tag);
-	    std::unordered_map<int, std::string>::const_iterator found = typemap.find(tag);
+	    std::unordered_map<int, std::string>::const_iterator found = maps.typemap.find(tag);
 	    auto str = it->getString().c_str();
-            jk(values, convertmsgtype(str, found->second));
+            // tags missing from every loaded dictionary are passed through as strings
+            jk(values, convertmsgtype(str, found != maps.typemap.end() ? found->second : "STRING"));
 	}
     }
 }
 
-static void addFIXGroupsToKDict(FIX::FieldMap::Groups::const_iterator g_begin, FIX::FieldMap::Groups::const_iterator g_end, K* keys, K* values)
+static void addFIXGroupsToKDict(const FIXMaps& maps, FIX::FieldMap::Groups::const_iterator g_begin, FIX::FieldMap::Groups::const_iterator g_end, K* keys, K* values)
 {
     for (auto git = g_begin; git != g_end; git++) {
         J groupTag = (J) git->first;
@@ -85,8 +105,8 @@ static void addFIXGroupsToKDict(FIX::FieldMap::Groups::const_iterator g_begin, F
 	for (auto it = git->second.begin(); it != git->second.end(); it++) {
             K kGroupInstKeys = ktn(KJ, 0);
             K kGroupInstValues = ktn(0, 0);
-	    addFIXAtomsToKDict((*it)->begin(), (*it)->end(), &kGroupInstKeys, &kGroupInstValues);
-	    addFIXGroupsToKDict((*it)->g_begin(), (*it)->g_end(), &kGroupInstKeys, &kGroupInstValues);
+	    addFIXAtomsToKDict(maps, (*it)->begin(), (*it)->end(), &kGroupInstKeys, &kGroupInstValues);
+	    addFIXGroupsToKDict(maps, (*it)->g_begin(), (*it)->g_end(), &kGroupInstKeys, &kGroupInstValues);
 	    jk(&kGroup, xD(kGroupInstKeys, kGroupInstValues));
         }
 	jk(values, kGroup);
@@ -101,41 +121,59 @@ static K ConvertToDictionary(const FIX::Message& message)
     auto header = message.getHeader();
     auto trailer = message.getTrailer();
 
-    addFIXAtomsToKDict(header.begin(), header.end(), &keys, &values);
-    addFIXAtomsToKDict(message.begin(), message.end(), &keys, &values);
-    addFIXGroupsToKDict(message.g_begin(), message.g_end(), &keys, &values);
-    addFIXAtomsToKDict(trailer.begin(), trailer.end(), &keys, &values);
+    std::shared_ptr<const FIXMaps> maps = std::atomic_load(&fixMaps);
+    addFIXAtomsToKDict(*maps, header.begin(), header.end(), &keys, &values);
+    addFIXAtomsToKDict(*maps, message.begin(), message.end(), &keys, &values);
+    addFIXGroupsToKDict(*maps, message.g_begin(), message.g_end(), &keys, &values);
+    addFIXAtomsToKDict(*maps, trailer.begin(), trailer.end(), &keys, &values);
 
     return xD(keys, values);
 }
 
-static void WriteToSocket(K x)
+static void DeliverToQ(const FIX::Message& message, const FIX::SessionID& sessionID)
 {
-    static char buffer[8192];
+    std::string function;
+    bool routed = RouteMessage(message, sessionID, function);
+    SessionHistory* history = FindHistory(sessionID.toString());
+
+    // unrouted messages are only converted if the session keeps a history of them
+    if (!routed && history == nullptr)
+        return;
 
+    K x = ConvertToDictionary(message);
     K bytes = b9(-1, x);
     r0(x);
 
-    memcpy(&buffer, (char*) &bytes->n, sizeof(J));
-    memcpy(&buffer[sizeof(J)], kG(bytes), (size_t) bytes->n);
- 
-    send(sockets[0], buffer, (int) sizeof(J) + bytes->n, 0);
+    if (history != nullptr)
+        history->Record(message, (const char*) kG(bytes), (size_t) bytes->n);
+
+    // replayed and followed messages arrive without a session and are neither journaled nor published
+    bool live = !sessionID.getBeginString().getValue().empty();
+
+    if (routed) {
+        if (live && JournalEnabled())
+            JournalAppend(function.c_str(), (const char*) kG(bytes), (size_t) bytes->n);
+        if (live && PublishEnabled())
+            PublishAppend((const char*) kG(bytes), (size_t) bytes->n);
+        EnqueueDelivery(function.c_str(), (const char*) kG(bytes), (size_t) bytes->n);
+    }
     r0(bytes);
 }
 
 void FixEngineApplication::onCreate(const FIX::SessionID& sessionID)
 {
-
+    EnqueueEvent(".fix.onEvent", "create", sessionID.toString(), 0, "");
 }
 
 void FixEngineApplication::onLogon(const FIX::SessionID& sessionID)
 {
-
+    ApplySessionTuning(sessionID);
+    EnqueueEvent(".fix.onEvent", "logon", sessionID.toString(), 0, "");
 }
 
 void FixEngineApplication::onLogout(const FIX::SessionID& sessionID)
 {
-
+    EnqueueEvent(".fix.onEvent", "logout", sessionID.toString(), 0, "");
 }
 
 void FixEngineApplication::toAdmin(FIX::Message& message, const FIX::SessionID& sessionID)
@@ -145,58 +183,52 @@ void FixEngineApplication::toAdmin(FIX::Message& message, const FIX::SessionID&
 
 void FixEngineApplication::toApp(FIX::Message& message, const FIX::SessionID& sessionID) throw (FIX::DoNotSend)
 {
-
+    // QuickFIX resends answer a ResendRequest with PossDupFlag set; the originals were already applied
+    const FIX::Header& header = message.getHeader();
+    bool possDup = header.isSetField(43) && header.getField(43) == "Y";
+    // replayed load isn't this process's order flow
+    if (orderCacheEnabled && !possDup && !loadSenderThread)
+        UpdateOrderState(message);
 }
 
 void FixEngineApplication::fromAdmin(const FIX::Message& message, const FIX::SessionID& sessionID) throw (FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::RejectLogon)
 {
-    WriteToSocket(ConvertToDictionary(message));
+    ApplySessionTuning(sessionID);
+    DeliverToQ(message, sessionID);
 }
 
 void FixEngineApplication::fromApp(const FIX::Message& message, const FIX::SessionID& sessionID) throw (FIX::FieldNotFound, FIX::IncorrectDataFormat, FIX::IncorrectTagValue, FIX::UnsupportedMessageType)
 {
-    WriteToSocket(ConvertToDictionary(message));
+    ApplySessionTuning(sessionID);
+    if (orderCacheEnabled)
+        UpdateOrderState(message);
+    DeliverToQ(message, sessionID);
 }
 
 #pragma GCC diagnostic pop
 
-void convertKGroupInstToFIX(FIX::Group& fixGroup, K kGroupInst)
+static void BuildFIXMessage(K x, FIX::Message& message)
 {
-    K keys = kK(kGroupInst)[0];
-    K values = kK(kGroupInst)[1];
+    K keys = kK(x)[0];
+    K values = kK(x)[1];
+ 
+    FIX::Header &header = message.getHeader();
+
+    // group layouts are looked up by MsgType, which may come after the groups
+    std::string msgType;
+    for (int i = 0; i < keys->n; i++)
+        if (kJ(keys)[i] == 35)
+            msgType = typedtostring(kK(values)[i]);
+
     for (int i = 0; i < keys->n; i++) {
         int tag = kJ(keys)[i];
-        K value = kK(values)[i];
-        if (value->t == 0 || value->t == 99) {
-            for (int i = 0; i < value->n; i++) {
-                K kGroupInst = kK(value)[i];
-                K keys = kK(kGroupInst)[0];
-                int delimTag = kJ(keys)[(keys->n)-1];
-		std::vector<int> tagOrder;
-                for (int k = 0; k < keys->n; k++)
-                    tagOrder.push_back(kJ(keys)[k]);
-                FIX::Group fixSubGroup(tag, delimTag, tagOrder.data());
-                convertKGroupInstToFIX(fixSubGroup, kGroupInst);
-                fixGroup.addGroup(fixSubGroup);
-            }
-        } else {
-                fixGroup.setField(tag, typedtostring(value));
-        }
-    }
-}
-
-void addKGroupToFIXMessage(FIX::Message& message, int groupTag, K kGroup)
-{
-    for (int i = 0; i < kGroup->n; i++) {
-        K kGroupInst = kK(kGroup)[i];
-        K keys = kK(kGroupInst)[0];
-        int delimTag = kJ(keys)[(keys->n)-1];
-	std::vector<int> tagOrder;
-	for (int k = 0; k < keys->n; k++)
-            tagOrder.push_back(kJ(keys)[k]);
-        FIX::Group fixGroup(groupTag, delimTag, tagOrder.data());
-        convertKGroupInstToFIX(fixGroup, kGroupInst);
-        message.addGroup(fixGroup);
+	K value = kK(values)[i];
+        if (tag == 35 || tag == 8 || tag == 49 || tag == 56)
+            header.setField(tag, typedtostring(value));
+        else if (IsGroupValue(value))
+            EncodeGroup(message, msgType, groupDictionary, tag, value);
+	else
+            message.setField(tag, typedtostring(value));
     }
 }
 
@@ -207,21 +239,24 @@ K SendMessageDict(K x)
     if (x->t != 99 || kK(x)[0]->t != 7 || kK(x)[1]->t != 0)
         return krr((S) "type");
 
-    K keys = kK(x)[0];
-    K values = kK(x)[1];
- 
-    FIX::Message message;
-    FIX::Header &header = message.getHeader();
+    if (AsyncSendEnabled()) {
+        FIX::Message* message = new FIX::Message;
+        try {
+            BuildFIXMessage(x, *message);
+        } catch (std::exception& ex) {
+            delete message;
+            std::cout << "unable to send message - " << ex.what() << std::endl;
+            return krr((S) "group");
+        }
+        return kj(EnqueueOutbound(message));
+    }
 
-    for (int i = 0; i < keys->n; i++) {
-        int tag = kJ(keys)[i];
-	K value = kK(values)[i];
-        if (tag == 35 || tag == 8 || tag == 49 || tag == 56)
-            header.setField(tag, typedtostring(value));
-        else if (value->t == 0 || value->t == 99)
-            addKGroupToFIXMessage(message, tag, value);
-	else
-            message.setField(tag, typedtostring(value));
+    FIX::Message message;
+    try {
+        BuildFIXMessage(x, message);
+    } catch (std::exception& ex) {
+        std::cout << "unable to send message - " << ex.what() << std::endl;
+        return krr((S) "group");
     }
 
     try {
@@ -233,32 +268,179 @@ K SendMessageDict(K x)
     return (K) 0;
 }
 
-static inline void ReadBytes(int numbytes, char (*buf)[4096])
+extern "C"
+K SetSendMode(K mode, K cpu, K acks)
 {
-    int total = 0;
-    do { total += recv(sockets[1], &buf[total], (int) (numbytes - total), 0); } while (total < numbytes);
+    if (-11 != mode->t || -1 != acks->t)
+        return krr((S) "type");
+    if (-6 != cpu->t && -7 != cpu->t)
+        return krr((S) "type");
+
+    if (strcmp("sync", mode->s) == 0) {
+        StopAsyncSend();
+    } else if (strcmp("async", mode->s) == 0) {
+        StartAsyncSend(-6 == cpu->t ? cpu->i : (int) cpu->j, acks->g);
+    } else {
+        return krr((S) "mode");
+    }
+
+    return (K) 0;
+}
+
+static std::string KAtomToString(K x)
+{
+    if (-11 == x->t)
+        return std::string(x->s);
+    if (10 == x->t)
+        return std::string((const char*) kC(x), (size_t) x->n);
+    if (-10 == x->t)
+        return std::string(1, (char) x->g);
+    if (-6 == x->t)
+        return std::to_string(x->i);
+    if (-7 == x->t)
+        return std::to_string(x->j);
+    return typedtostring(x);
 }
 
 extern "C"
-K RecieveData(I x)
+K HistoryLookup(K session, K tag, K value)
 {
-    static char buf[4096];
-    J size = 0;
+    if (-11 != session->t || (-6 != tag->t && -7 != tag->t))
+        return krr((S) "type");
 
-    ReadBytes(sizeof(J), &buf);
-    memcpy(&size, buf, sizeof(J));
-   
-    K bytes = ktn(KG, size);
+    SessionHistory* history = FindHistory(session->s);
+    if (history == nullptr)
+        return krr((S) "session");
 
-    ReadBytes(size, &buf);
-    memcpy(kG(bytes), &buf, (size_t) size);
-    K r = k(0, (char *)".fix.onRecv", d9(bytes), (K) 0);
-    r0(bytes);
+    std::vector<std::string> payloads;
+    if (!history->Lookup(-6 == tag->t ? tag->i : (int) tag->j, KAtomToString(value), payloads))
+        return krr((S) "index");
+    return PayloadsToK(payloads);
+}
+
+extern "C"
+K HistoryRange(K session, K fromSeq, K toSeq)
+{
+    if (-11 != session->t || (-6 != fromSeq->t && -7 != fromSeq->t) || (-6 != toSeq->t && -7 != toSeq->t))
+        return krr((S) "type");
+
+    SessionHistory* history = FindHistory(session->s);
+    if (history == nullptr)
+        return krr((S) "session");
+
+    std::vector<std::string> payloads;
+    history->Range(-6 == fromSeq->t ? fromSeq->i : fromSeq->j, -6 == toSeq->t ? toSeq->i : toSeq->j, payloads);
+    return PayloadsToK(payloads);
+}
+
+extern "C"
+K Orders(K x)
+{
+    if (!orderCacheEnabled)
+        return krr((S) "orderStateCache");
+
+    std::lock_guard<std::mutex> lock(orderCacheMutex);
+    std::vector<size_t> all(orderStates.size());
+    for (size_t i = 0; i < all.size(); i++)
+        all[i] = i;
+    return OrderStatesToTable(all);
+}
+
+extern "C"
+K OrderDeltas(K x)
+{
+    if (!orderCacheEnabled)
+        return krr((S) "orderStateCache");
+
+    std::lock_guard<std::mutex> lock(orderCacheMutex);
+    K deltas = OrderStatesToTable(orderDeltas);
+    for (auto it = orderDeltas.begin(); it != orderDeltas.end(); it++)
+        orderDirty[*it] = false;
+    orderDeltas.clear();
+    return deltas;
+}
 
-    if (r != 0) { r0(r); }
+extern "C"
+K OrderAggregates(K x)
+{
+    if (!orderCacheEnabled)
+        return krr((S) "orderStateCache");
+
+    std::lock_guard<std::mutex> lock(orderCacheMutex);
+    return OrderAggregatesToTable();
+}
+
+static bool KToMsgType(K x, std::string& msgType)
+{
+    if (-10 == x->t)
+        msgType = std::string(1, (char) x->g);
+    else if (10 == x->t)
+        msgType = std::string((const char*) kC(x), (size_t) x->n);
+    else if (-11 == x->t)
+        msgType = std::string(x->s);
+    else
+        return false;
+    return !msgType.empty();
+}
+
+extern "C"
+K Route(K msgType, K session, K function)
+{
+    std::string type;
+    if (!KToMsgType(msgType, type) || -11 != session->t || -11 != function->t || '\0' == function->s[0])
+        return krr((S) "type");
+
+    SetRoute(session->s, type, function->s);
     return (K) 0;
 }
 
+extern "C"
+K Unroute(K msgType, K session)
+{
+    std::string type;
+    if (!KToMsgType(msgType, type) || -11 != session->t)
+        return krr((S) "type");
+
+    if (!RemoveRoute(session->s, type))
+        return krr((S) "route");
+    return (K) 0;
+}
+
+extern "C"
+K Routes(K x)
+{
+    return RoutesToTable();
+}
+
+extern "C"
+K RecieveData(I x)
+{
+    DrainDeliveries();
+    return (K) 0;
+}
+
+extern "C"
+K DeliveryStats(K reset)
+{
+    if (reset->t != -1)
+        return krr((S) "type");
+
+    K stats = deliveryLatency.ToDictionary();
+    J wakeups = deliveryWakeups.load();
+    J dropped = routeDropped.load();
+    js(&kK(stats)[0], ss((S) "wakeups"));
+    jk(&kK(stats)[1], kj(wakeups));
+    js(&kK(stats)[0], ss((S) "dropped"));
+    jk(&kK(stats)[1], kj(dropped));
+
+    if (reset->g) {
+        deliveryLatency.Reset();
+        deliveryWakeups.store(0);
+        routeDropped.store(0);
+    }
+    return stats;
+}
+
 template<typename T>
 K CreateThreadedSocket(K x) {
     if (x->t != -11) {
@@ -274,9 +456,27 @@ K CreateThreadedSocket(K x) {
     auto application = new FixEngineApplication;
     auto store = new FIX::FileStoreFactory(*settings);
     auto log = new FIX::FileLogFactory(*settings);
-    
-    dumb_socketpair(sockets, 0);
-    sd1(sockets[1], RecieveData);
+
+    if (settings->get().has("DeliverySpinMicros"))
+        deliverySpinNanos = (J) settings->get().getInt("DeliverySpinMicros") * 1000;
+    LoadSessionTuning(*settings);
+    LoadHistorySettings(*settings);
+    if (settings->get().has("OrderStateCache") && settings->get().getBool("OrderStateCache"))
+        orderCacheEnabled = true;
+
+    if (settings->get().has("JournalPath")) {
+        const FIX::Dictionary& defaults = settings->get();
+        J groupCommitNanos = defaults.has("JournalGroupCommitMicros") ? (J) defaults.getInt("JournalGroupCommitMicros") * 1000 : 0;
+        J fsyncNanos = defaults.has("JournalFsyncMillis") ? (J) defaults.getInt("JournalFsyncMillis") * 1000000 : -1;
+        if (!StartJournal(defaults.getString("JournalPath"), groupCommitNanos, fsyncNanos))
+            return krr((S) "journal");
+    }
+
+    if (settings->get().has("Subscribers") && !StartPublish(settings->get()))
+        return krr((S) "publish");
+
+    if (!StartDelivery(RecieveData))
+        return krr((S) "os");
 
     T *socket = nullptr;
     socket = new T(*application, *store, *settings, *log);
@@ -291,20 +491,29 @@ void CreateFIXMaps(K dataDictFile)
     std::string path = std::string(dataDictFile->s);
     path.erase(std::remove(path.begin(), path.end(), ':'), path.end());
 
+    std::lock_guard<std::mutex> lock(fixMapsMutex);
+    std::shared_ptr<const FIXMaps> current = std::atomic_load(&fixMaps);
+    if (current->dictionaries.count(path))
+        return;
+
     std::cout << "CreateFIXMaps - Loading " << path << std::endl;
     pugi::xml_document doc;
     if(!doc.load_file(path.c_str())) throw std::runtime_error("XML could not be loaded");
 
+    // merge into a copy; existing tags keep their types
+    std::shared_ptr<FIXMaps> updated = std::make_shared<FIXMaps>(*current);
+    updated->dictionaries.insert(path);
     pugi::xml_node fields = doc.child("fix").child("fields");
     for(pugi::xml_node field = fields.child("field"); field; field = field.next_sibling("field"))
     {
         int tag = field.attribute("number").as_int();
         std::string fixType = field.attribute("type").value();
         if (fixType == "NUMINGROUP")
-            repeatingGroupTags.insert(tag);
+            updated->repeatingGroupTags.insert(tag);
         std::string kType = typeconvert(fixType);
-        typemap.insert({tag, kType});
+        updated->typemap.insert({tag, kType});
     }
+    std::atomic_store(&fixMaps, std::shared_ptr<const FIXMaps>(updated));
 }
 
 K GetKMaps(K dataDictFile)
@@ -356,6 +565,10 @@ K Create(K counterPartyType, K configFile, K dataDictFile) {
     }
     CreateFIXMaps(dataDictFile);
 
+    std::string dataDictFilePath = std::string(dataDictFile->s);
+    dataDictFilePath.erase(std::remove(dataDictFilePath.begin(), dataDictFilePath.end(), ':'), dataDictFilePath.end());
+    LoadGroupDictionary(dataDictFilePath);
+
     K defaultConfigFile = ks((S) "src/config/sessions/sample.ini");
 
     if (-11 == configFile->t){
@@ -446,6 +659,172 @@ K ReplayFIXLog(K dataDictFile, K fixLogFile) {
     }
 }
 
+extern "C"
+K LogToHDB(K dataDictFile, K fixLogFiles, K hdbDir) {
+
+    if(-11 != dataDictFile->t || (-11 != fixLogFiles->t && 11 != fixLogFiles->t) || -11 != hdbDir->t)
+        return krr((S) "type");
+
+    std::string dataDictFilePath = std::string(dataDictFile->s);
+    dataDictFilePath.erase(std::remove(dataDictFilePath.begin(), dataDictFilePath.end(), ':'), dataDictFilePath.end());
+
+    std::vector<std::string> fixLogFilePaths;
+    J count = -11 == fixLogFiles->t ? 1 : fixLogFiles->n;
+    for (J i = 0; i < count; i++) {
+        std::string path = std::string(-11 == fixLogFiles->t ? fixLogFiles->s : kS(fixLogFiles)[i]);
+        path.erase(std::remove(path.begin(), path.end(), ':'), path.end());
+        fixLogFilePaths.push_back(path);
+    }
+
+    // a mistyped path would otherwise leave its dates out of the HDB unnoticed
+    bool readable = true;
+    for (auto it = fixLogFilePaths.begin(); it != fixLogFilePaths.end(); it++) {
+        if (!std::ifstream(*it)) {
+            std::cout << "logToHDB - unable to open " << *it << std::endl;
+            readable = false;
+        }
+    }
+    if (!readable)
+        return krr((S) "os");
+
+    std::map<std::string, HdbSchema> schemas;
+    FIX::DataDictionary* dataDict;
+    try {
+        LoadHdbSchemas(dataDictFilePath, schemas);
+        std::ifstream dataDictFileStream(dataDictFilePath);
+        dataDict = new FIX::DataDictionary(dataDictFileStream);
+    } catch (std::exception& ex) {
+        std::cout << "logToHDB - unable to load " << dataDictFilePath << ": " << ex.what() << std::endl;
+        return krr((S) "dataDict");
+    }
+
+    size_t decoders = std::max(1u, std::thread::hardware_concurrency());
+    HdbConverter converter(schemas, *dataDict, fixLogFilePaths, 2 * decoders + 2);
+    K error = converter.Run(hdbDir, decoders);
+    delete dataDict;
+    if (error != 0)
+        return error;
+    if (!converter.missing.empty())
+        return krr((S) "os");
+
+    K r = k(0, (S) ".Q.chk", r1(hdbDir), (K) 0);
+    if (r != 0 && r->t == -128) {
+        K chk = krr(ss(r->s));
+        r0(r);
+        return chk;
+    }
+    if (r != 0)
+        r0(r);
+
+    K keys = ktn(KS, 2);
+    K values = ktn(KJ, 2);
+    kS(keys)[0] = ss((S) "messages");
+    kS(keys)[1] = ss((S) "skipped");
+    kJ(values)[0] = converter.messages;
+    kJ(values)[1] = converter.skipped;
+    return xD(keys, values);
+}
+
+extern "C"
+K LoadReplay(K dataDictFile, K fixLogFile, K session, K speed, K origSender) {
+
+    if(-11 != dataDictFile->t || -11 != fixLogFile->t || -11 != session->t || -11 != origSender->t)
+        return krr((S) "type");
+    if(-9 != speed->t && -7 != speed->t && -6 != speed->t)
+        return krr((S) "type");
+
+    std::string dataDictFilePath = std::string(dataDictFile->s);
+    dataDictFilePath.erase(std::remove(dataDictFilePath.begin(), dataDictFilePath.end(), ':'), dataDictFilePath.end());
+    std::string fixLogFilePath = std::string(fixLogFile->s);
+    fixLogFilePath.erase(std::remove(fixLogFilePath.begin(), fixLogFilePath.end(), ':'), fixLogFilePath.end());
+
+    FIX::SessionID sessionID;
+    sessionID.fromString(session->s);
+    double pace = -9 == speed->t ? speed->f : -7 == speed->t ? (double) speed->j : (double) speed->i;
+    // also rejects NaN and the integer nulls
+    if (!(pace >= 0))
+        return krr((S) "domain");
+
+    FIX::DataDictionary* dataDict;
+    try {
+        std::ifstream dataDictFileStream(dataDictFilePath);
+        dataDict = new FIX::DataDictionary(dataDictFileStream);
+    } catch (std::exception& ex) {
+        std::cout << "loadReplay - unable to load " << dataDictFilePath << ": " << ex.what() << std::endl;
+        return krr((S) "dataDict");
+    }
+
+    if (!StartDelivery(RecieveData)) {
+        delete dataDict;
+        return krr((S) "os");
+    }
+    if (!StartLoad(dataDict, fixLogFilePath, sessionID, pace, origSender->s)) {
+        delete dataDict;
+        return krr((S) "running");
+    }
+    return (K) 0;
+}
+
+extern "C"
+K LoadStats(K x) {
+    return LoadStatsToDictionary();
+}
+
+extern "C"
+K LoadStop(K x) {
+    StopLoad();
+    return (K) 0;
+}
+
+static FixEngineApplication followApplication;
+
+extern "C"
+K FollowFIXLog(K dataDictFile, K fixLogFile, K offsetsFile) {
+
+    if(-11 != dataDictFile->t || -11 != fixLogFile->t || -11 != offsetsFile->t)
+        return krr((S) "type");
+
+    std::string dataDictFilePath = std::string(dataDictFile->s);
+    dataDictFilePath.erase(std::remove(dataDictFilePath.begin(), dataDictFilePath.end(), ':'), dataDictFilePath.end());
+    std::string fixLogFilePath = std::string(fixLogFile->s);
+    fixLogFilePath.erase(std::remove(fixLogFilePath.begin(), fixLogFilePath.end(), ':'), fixLogFilePath.end());
+    std::string offsetsFilePath = std::string(offsetsFile->s);
+    offsetsFilePath.erase(std::remove(offsetsFilePath.begin(), offsetsFilePath.end(), ':'), offsetsFilePath.end());
+
+    // a follower process need not have created any sessions, and the log may
+    // use tags the sessions' dictionary doesn't have; existing tags are kept
+    try {
+        CreateFIXMaps(dataDictFile);
+    } catch (std::exception& ex) {
+        std::cout << "FollowFIXLog - unable to load " << dataDictFilePath << ": " << ex.what() << std::endl;
+        return krr((S) "dictionary");
+    }
+    if (!StartDelivery(RecieveData))
+        return krr((S) "os");
+
+    if (!StartFollow(dataDictFilePath, fixLogFilePath, offsetsFilePath, &followApplication))
+        return krr((S) "follow");
+    return (K) 0;
+}
+
+extern "C"
+K UnfollowFIXLog(K fixLogFile) {
+
+    if(-11 != fixLogFile->t)
+        return krr((S) "type");
+
+    std::string fixLogFilePath = std::string(fixLogFile->s);
+    fixLogFilePath.erase(std::remove(fixLogFilePath.begin(), fixLogFilePath.end(), ':'), fixLogFilePath.end());
+    if (!StopFollow(fixLogFilePath))
+        return krr((S) "follow");
+    return (K) 0;
+}
+
+extern "C"
+K Subscribers(K x) {
+    return SubscribersToTable();
+}
+
 extern "C"
 K LoadLibrary(K x)
 {
@@ -461,8 +840,8 @@ K LoadLibrary(K x)
     printf(" compiler flags » %-5s                              \n", BUILD_COMPILER_FLAGS);
     printf("████████████████████████████████████████████████████\n");
 
-    K keys = ktn(KS, 6);
-    K values = ktn(0, 6);
+    K keys = ktn(KS, 23);
+    K values = ktn(0, 23);
 
     kS(keys)[0] = ss((S) "send");
     kS(keys)[1] = ss((S) "onRecv");
@@ -470,6 +849,23 @@ K LoadLibrary(K x)
     kS(keys)[3] = ss((S) "version");
     kS(keys)[4] = ss((S) "getKMaps");
     kS(keys)[5] = ss((S) "replayFIXLog");
+    kS(keys)[6] = ss((S) "deliveryStats");
+    kS(keys)[7] = ss((S) "sendMode");
+    kS(keys)[8] = ss((S) "historyLookup");
+    kS(keys)[9] = ss((S) "historyRange");
+    kS(keys)[10] = ss((S) "orders");
+    kS(keys)[11] = ss((S) "orderDeltas");
+    kS(keys)[12] = ss((S) "orderAggregates");
+    kS(keys)[13] = ss((S) "followFIXLog");
+    kS(keys)[14] = ss((S) "unfollowFIXLog");
+    kS(keys)[15] = ss((S) "subscribers");
+    kS(keys)[16] = ss((S) "route");
+    kS(keys)[17] = ss((S) "unroute");
+    kS(keys)[18] = ss((S) "routes");
+    kS(keys)[19] = ss((S) "logToHDB");
+    kS(keys)[20] = ss((S) "loadReplay");
+    kS(keys)[21] = ss((S) "loadStats");
+    kS(keys)[22] = ss((S) "loadStop");
 
     kK(values)[0] = dl((void *) SendMessageDict, 1);
     kK(values)[1] = dl((void *) OnRecv, 1);
@@ -477,6 +873,23 @@ K LoadLibrary(K x)
     kK(values)[3] = dl((void *) Version, 1);
     kK(values)[4] = dl((void *) GetKMaps, 1);
     kK(values)[5] = dl((void *) ReplayFIXLog, 2);
+    kK(values)[6] = dl((void *) DeliveryStats, 1);
+    kK(values)[7] = dl((void *) SetSendMode, 3);
+    kK(values)[8] = dl((void *) HistoryLookup, 3);
+    kK(values)[9] = dl((void *) HistoryRange, 3);
+    kK(values)[10] = dl((void *) Orders, 1);
+    kK(values)[11] = dl((void *) OrderDeltas, 1);
+    kK(values)[12] = dl((void *) OrderAggregates, 1);
+    kK(values)[13] = dl((void *) FollowFIXLog, 3);
+    kK(values)[14] = dl((void *) UnfollowFIXLog, 1);
+    kK(values)[15] = dl((void *) Subscribers, 1);
+    kK(values)[16] = dl((void *) Route, 3);
+    kK(values)[17] = dl((void *) Unroute, 2);
+    kK(values)[18] = dl((void *) Routes, 1);
+    kK(values)[19] = dl((void *) LogToHDB, 3);
+    kK(values)[20] = dl((void *) LoadReplay, 5);
+    kK(values)[21] = dl((void *) LoadStats, 1);
+    kK(values)[22] = dl((void *) LoadStop, 1);
 
     return xD(keys, values);
 }
@@ -553,8 +966,9 @@ struct Tm : std::tm {
     }
 };
 
+// seconds since the unix epoch to a timestamp; pure arithmetic as this runs on decoding threads
 K pu(I x){
-    return k(0, (S) "`timestamp$", kz(x/8.64e4 - 10957), (K)0);
+    return ktj(-KP, ((J) x - 946684800LL) * 1000000000LL);
 };
 
 K strtotemporal(std::string datestring){
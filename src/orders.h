@@ -0,0 +1,265 @@
+/* orders.h
+ * Native order-state cache built from both directions of order flow.
+ *
+ * Outbound NewOrderSingle (D), OrderCancelRequest (F) and
+ * OrderCancelReplaceRequest (G) are seen through toApp; ExecutionReports (8)
+ * and OrderCancelRejects (9) through fromApp, or either way round when the
+ * adaptor is the sell side. Outbound resends (PossDupFlag=Y) are ignored, as
+ * the originals have already been applied. Every ClOrdID in a cancel/replace
+ * chain resolves to the same order, which tracks OrdStatus, CumQty, LeavesQty
+ * and AvgPx.
+ * Per symbol/side aggregates are maintained incrementally as orders change.
+ *
+ * Enabled with OrderStateCache=Y in the DEFAULT block of the session settings
+ * file. q reads the cache as tables, either whole or as the orders changed
+ * since the last call for deltas.
+ */
+
+#ifndef KDBFIX_ORDERS_H
+#define KDBFIX_ORDERS_H
+
+#include <quickfix/Message.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <kx/k.h>
+
+struct OrderState
+{
+    std::string rootClOrdID;
+    std::string clOrdID;
+    std::string orderID;
+    std::string symbol;
+    char side;
+    char ordStatus;
+    char pending;
+    double orderQty;
+    double price;
+    double cumQty;
+    double leavesQty;
+    double avgPx;
+    J updated;
+    J updates;
+};
+
+struct OrderAggregate
+{
+    J orders;
+    J openOrders;
+    double orderQty;
+    double cumQty;
+    double leavesQty;
+    double notional;
+};
+
+static std::mutex orderCacheMutex;
+static bool orderCacheEnabled = false;
+static std::vector<OrderState> orderStates;
+static std::unordered_map<std::string, size_t> ordersByClOrdID;
+static std::unordered_map<std::string, size_t> ordersByOrderID;
+static std::map<std::pair<std::string, char>, OrderAggregate> orderAggregates;
+static std::vector<size_t> orderDeltas;
+static std::vector<bool> orderDirty;
+
+static bool IsOpenOrdStatus(char status)
+{
+    // filled, canceled, rejected, expired and done for day are terminal
+    return status != '2' && status != '4' && status != '8' && status != 'C' && status != '3';
+}
+
+static J KdbNow()
+{
+    return (J) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() - 946684800000000000LL;
+}
+
+static void ApplyToAggregate(const OrderState& order, int sign)
+{
+    auto key = std::make_pair(order.symbol, order.side);
+    OrderAggregate& aggregate = orderAggregates[key];
+    bool open = IsOpenOrdStatus(order.ordStatus);
+    aggregate.orders += sign;
+    aggregate.openOrders += open ? sign : 0;
+    aggregate.orderQty += sign * order.orderQty;
+    aggregate.cumQty += sign * order.cumQty;
+    aggregate.leavesQty += open ? sign * order.leavesQty : 0;
+    aggregate.notional += sign * order.cumQty * order.avgPx;
+
+    // orders move bucket when their symbol/side is first learnt
+    if (aggregate.orders == 0)
+        orderAggregates.erase(key);
+}
+
+static bool GetFieldIfSet(const FIX::FieldMap& fields, int tag, std::string& value)
+{
+    if (!fields.isSetField(tag))
+        return false;
+    value = fields.getField(tag);
+    return true;
+}
+
+static size_t FindOrCreateOrder(const FIX::Message& message, bool create, bool& found)
+{
+    std::string id;
+    found = true;
+    if (GetFieldIfSet(message, 11, id)) {
+        auto it = ordersByClOrdID.find(id);
+        if (it != ordersByClOrdID.end())
+            return it->second;
+    }
+    if (GetFieldIfSet(message, 41, id)) {
+        auto it = ordersByClOrdID.find(id);
+        if (it != ordersByClOrdID.end())
+            return it->second;
+    }
+    if (GetFieldIfSet(message, 37, id)) {
+        auto it = ordersByOrderID.find(id);
+        if (it != ordersByOrderID.end())
+            return it->second;
+    }
+
+    found = false;
+    if (!create || !message.isSetField(11))
+        return 0;
+
+    OrderState order = { message.getField(11), message.getField(11), "", "", ' ', 'A', ' ', 0, 0, 0, 0, 0, 0, 0 };
+    orderStates.push_back(order);
+    orderDirty.push_back(false);
+    ordersByClOrdID[order.clOrdID] = orderStates.size() - 1;
+    ApplyToAggregate(orderStates.back(), 1);
+    found = true;
+    return orderStates.size() - 1;
+}
+
+static void UpdateOrderState(const FIX::Message& message)
+{
+    const FIX::Header& header = message.getHeader();
+    if (!header.isSetField(35))
+        return;
+    const std::string& msgType = header.getField(35);
+    if (msgType != "D" && msgType != "F" && msgType != "G" && msgType != "8" && msgType != "9")
+        return;
+
+    std::lock_guard<std::mutex> lock(orderCacheMutex);
+
+    bool found = false;
+    size_t index = FindOrCreateOrder(message, msgType == "D" || msgType == "8", found);
+    if (!found)
+        return;
+
+    OrderState& order = orderStates[index];
+    ApplyToAggregate(order, -1);
+
+    std::string value;
+    if (GetFieldIfSet(message, 55, value)) order.symbol = value;
+    if (GetFieldIfSet(message, 54, value) && !value.empty()) order.side = value[0];
+
+    if (msgType == "D") {
+        if (GetFieldIfSet(message, 38, value)) order.leavesQty = order.orderQty = atof(value.c_str());
+        if (GetFieldIfSet(message, 44, value)) order.price = atof(value.c_str());
+    } else if (msgType == "F" || msgType == "G") {
+        // the request's ClOrdID joins the chain; the order keeps its current id until it's acknowledged
+        if (GetFieldIfSet(message, 11, value))
+            ordersByClOrdID[value] = index;
+        order.pending = msgType[0];
+    } else {
+        if (GetFieldIfSet(message, 37, value) && value != order.orderID) {
+            order.orderID = value;
+            ordersByOrderID[value] = index;
+        }
+        if (GetFieldIfSet(message, 39, value) && !value.empty()) order.ordStatus = value[0];
+        if (msgType == "8") {
+            if (GetFieldIfSet(message, 11, value)) {
+                ordersByClOrdID[value] = index;
+                order.clOrdID = value;
+            }
+            if (GetFieldIfSet(message, 38, value)) order.orderQty = atof(value.c_str());
+            if (GetFieldIfSet(message, 44, value)) order.price = atof(value.c_str());
+            if (GetFieldIfSet(message, 14, value)) order.cumQty = atof(value.c_str());
+            if (GetFieldIfSet(message, 151, value)) order.leavesQty = atof(value.c_str());
+            if (GetFieldIfSet(message, 6, value)) order.avgPx = atof(value.c_str());
+        }
+        if (order.ordStatus != '6' && order.ordStatus != 'E')
+            order.pending = ' ';
+    }
+
+    order.updated = KdbNow();
+    order.updates++;
+    ApplyToAggregate(order, 1);
+
+    if (!orderDirty[index]) {
+        orderDirty[index] = true;
+        orderDeltas.push_back(index);
+    }
+}
+
+static K OrderStatesToTable(const std::vector<size_t>& indexes)
+{
+    const int columns = 14;
+    K names = ktn(KS, columns);
+    const char* columnNames[columns] = { "clOrdID", "rootClOrdID", "orderID", "symbol", "side", "ordStatus", "pending",
+        "orderQty", "price", "cumQty", "leavesQty", "avgPx", "updated", "updates" };
+    for (int i = 0; i < columns; i++)
+        kS(names)[i] = ss((S) columnNames[i]);
+
+    J n = (J) indexes.size();
+    K clOrdID = ktn(0, n), rootClOrdID = ktn(0, n), orderID = ktn(0, n), symbol = ktn(KS, n);
+    K side = ktn(KC, n), ordStatus = ktn(KC, n), pending = ktn(KC, n);
+    K orderQty = ktn(KF, n), price = ktn(KF, n), cumQty = ktn(KF, n), leavesQty = ktn(KF, n), avgPx = ktn(KF, n);
+    K updated = ktn(KP, n), updates = ktn(KJ, n);
+
+    for (J i = 0; i < n; i++) {
+        const OrderState& order = orderStates[indexes[i]];
+        kK(clOrdID)[i] = kp((S) order.clOrdID.c_str());
+        kK(rootClOrdID)[i] = kp((S) order.rootClOrdID.c_str());
+        kK(orderID)[i] = kp((S) order.orderID.c_str());
+        kS(symbol)[i] = ss((S) order.symbol.c_str());
+        kC(side)[i] = order.side;
+        kC(ordStatus)[i] = order.ordStatus;
+        kC(pending)[i] = order.pending;
+        kF(orderQty)[i] = order.orderQty;
+        kF(price)[i] = order.price;
+        kF(cumQty)[i] = order.cumQty;
+        kF(leavesQty)[i] = order.leavesQty;
+        kF(avgPx)[i] = order.avgPx;
+        kJ(updated)[i] = order.updated;
+        kJ(updates)[i] = order.updates;
+    }
+
+    return xT(xD(names, knk(columns, clOrdID, rootClOrdID, orderID, symbol, side, ordStatus, pending,
+        orderQty, price, cumQty, leavesQty, avgPx, updated, updates)));
+}
+
+static K OrderAggregatesToTable()
+{
+    K names = ktn(KS, 8);
+    const char* columnNames[8] = { "symbol", "side", "orders", "openOrders", "orderQty", "cumQty", "leavesQty", "avgPx" };
+    for (int i = 0; i < 8; i++)
+        kS(names)[i] = ss((S) columnNames[i]);
+
+    J n = (J) orderAggregates.size();
+    K symbol = ktn(KS, n), side = ktn(KC, n), orders = ktn(KJ, n), openOrders = ktn(KJ, n);
+    K orderQty = ktn(KF, n), cumQty = ktn(KF, n), leavesQty = ktn(KF, n), avgPx = ktn(KF, n);
+
+    J i = 0;
+    for (auto it = orderAggregates.begin(); it != orderAggregates.end(); it++, i++) {
+        kS(symbol)[i] = ss((S) it->first.first.c_str());
+        kC(side)[i] = it->first.second;
+        kJ(orders)[i] = it->second.orders;
+        kJ(openOrders)[i] = it->second.openOrders;
+        kF(orderQty)[i] = it->second.orderQty;
+        kF(cumQty)[i] = it->second.cumQty;
+        kF(leavesQty)[i] = it->second.leavesQty;
+        kF(avgPx)[i] = it->second.cumQty != 0 ? it->second.notional / it->second.cumQty : nf;
+    }
+
+    return xT(xD(names, knk(8, symbol, side, orders, openOrders, orderQty, cumQty, leavesQty, avgPx)));
+}
+
+#endif
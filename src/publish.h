@@ -0,0 +1,394 @@
+/* publish.h
+ * Fan-out of inbound messages to kdb+ subscribers over IPC.
+ *
+ * A background thread sends every message handed to q, reusing the b9 payload
+ * built for the hand-off, to each configured subscriber as an async
+ * (function;msg) call, so a tickerplant or RDB is fed without the q main
+ * thread republishing. Configured from the DEFAULT block of the session
+ * settings file:
+ *
+ *   Subscribers=host:port,unix://port   processes to publish to; unix:// uses
+ *                                       the local kdb+ Unix domain socket
+ *   SubscriberFunction=<function>       called on subscribers (.fix.onRecv)
+ *   SubscriberCredentials=user:pass     sent in the IPC handshake
+ *   SubscriberBufferBytes=<bytes>       how far a subscriber may fall behind
+ *                                       before it is evicted (64MB)
+ *   SubscriberReconnectMillis=<millis>  wait before reconnecting (5000)
+ *
+ * Each subscriber has its own buffer and non-blocking socket, so a slow one
+ * never holds up the others. One that falls too far behind is disconnected
+ * and its buffer discarded; it misses messages until it reconnects. At exit
+ * whatever is queued is buffered and connected subscribers are given up to
+ * PUBLISH_DRAIN_NANOS to take it.
+ */
+
+#ifndef KDBFIX_PUBLISH_H
+#define KDBFIX_PUBLISH_H
+
+#include <quickfix/Dictionary.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <kx/k.h>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "queue.h"
+#include "stats.h"
+
+enum SubscriberState { SUBSCRIBER_DOWN, SUBSCRIBER_CONNECTING, SUBSCRIBER_HANDSHAKE, SUBSCRIBER_CONNECTED };
+
+struct Subscriber
+{
+    std::string name;
+    std::vector<std::pair<sockaddr_storage, socklen_t> > addresses;
+    size_t nextAddress;
+    int fd;
+    std::string buffer;
+    size_t flushed;
+    J retryAt;
+    std::atomic<int> state;
+    std::atomic<J> messages;
+    std::atomic<J> bytes;
+    std::atomic<J> buffered;
+    std::atomic<J> dropped;
+    std::atomic<J> evictions;
+};
+
+static std::vector<Subscriber*> subscribers;
+static MpscQueue<std::string> publishQueue;
+static Parker publishParker;
+static std::thread* publishThread = nullptr;
+static std::atomic<bool> publishRunning(false);
+static const J PUBLISH_DRAIN_NANOS = 1000000000LL;
+static std::string publishFunction = ".fix.onRecv";
+static std::string publishCredentials;
+static size_t publishBufferBytes = 64 << 20;
+static J publishReconnectNanos = 5000000000LL;
+
+static bool PublishEnabled()
+{
+    return publishThread != nullptr;
+}
+
+static void PublishAppend(const char* data, size_t size)
+{
+    publishQueue.push(std::string(data, size));
+    publishParker.Unpark();
+}
+
+// kdb+ listens on both an abstract and a filesystem socket for -p port
+static bool ResolveSubscriber(const std::string& spec, Subscriber* subscriber)
+{
+    if (spec.compare(0, 7, "unix://") == 0) {
+        std::string path = "/tmp/kx." + spec.substr(7);
+        sockaddr_storage storage;
+        sockaddr_un* address = (sockaddr_un*) &storage;
+
+        memset(&storage, 0, sizeof(storage));
+        address->sun_family = AF_UNIX;
+        strncpy(address->sun_path + 1, path.c_str(), sizeof(address->sun_path) - 2);
+        subscriber->addresses.push_back(std::make_pair(storage, (socklen_t) (offsetof(sockaddr_un, sun_path) + 1 + path.size())));
+
+        memset(&storage, 0, sizeof(storage));
+        address->sun_family = AF_UNIX;
+        strncpy(address->sun_path, path.c_str(), sizeof(address->sun_path) - 1);
+        subscriber->addresses.push_back(std::make_pair(storage, (socklen_t) sizeof(sockaddr_un)));
+        return true;
+    }
+
+    size_t colon = spec.rfind(':');
+    if (colon == std::string::npos)
+        return false;
+    std::string host = colon == 0 ? "localhost" : spec.substr(0, colon);
+    std::string port = spec.substr(colon + 1);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* results = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &results) != 0)
+        return false;
+    for (addrinfo* it = results; it != nullptr; it = it->ai_next) {
+        sockaddr_storage storage;
+        memset(&storage, 0, sizeof(storage));
+        memcpy(&storage, it->ai_addr, it->ai_addrlen);
+        subscriber->addresses.push_back(std::make_pair(storage, (socklen_t) it->ai_addrlen));
+    }
+    freeaddrinfo(results);
+    return !subscriber->addresses.empty();
+}
+
+static void DisconnectSubscriber(Subscriber* subscriber, const char* reason)
+{
+    if (subscriber->state.load() == SUBSCRIBER_CONNECTED)
+        std::cout << "subscriber " << subscriber->name << " disconnected: " << reason << std::endl;
+    if (subscriber->fd >= 0)
+        close(subscriber->fd);
+    subscriber->fd = -1;
+    subscriber->buffer.clear();
+    subscriber->flushed = 0;
+    subscriber->buffered.store(0);
+    subscriber->retryAt = NowNanos() + publishReconnectNanos;
+    subscriber->state.store(SUBSCRIBER_DOWN);
+}
+
+// capability 3 with the credentials; the subscriber answers with one byte
+static void SendHandshake(Subscriber* subscriber)
+{
+    std::string handshake = publishCredentials;
+    handshake.push_back((char) 3);
+    handshake.push_back((char) 0);
+    if (send(subscriber->fd, handshake.data(), handshake.size(), MSG_NOSIGNAL) != (ssize_t) handshake.size()) {
+        DisconnectSubscriber(subscriber, strerror(errno));
+        return;
+    }
+    subscriber->state.store(SUBSCRIBER_HANDSHAKE);
+}
+
+static void ConnectSubscriber(Subscriber* subscriber)
+{
+    for (size_t attempts = 0; attempts < subscriber->addresses.size(); attempts++) {
+        const auto& address = subscriber->addresses[subscriber->nextAddress++ % subscriber->addresses.size()];
+        int fd = socket(address.first.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            continue;
+        if (address.first.ss_family != AF_UNIX) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        subscriber->fd = fd;
+        if (connect(fd, (const sockaddr*) &address.first, address.second) == 0) {
+            SendHandshake(subscriber);
+            return;
+        }
+        if (errno == EINPROGRESS || errno == EAGAIN) {
+            subscriber->state.store(SUBSCRIBER_CONNECTING);
+            return;
+        }
+        close(fd);
+        subscriber->fd = -1;
+    }
+    subscriber->retryAt = NowNanos() + publishReconnectNanos;
+}
+
+static void AdvanceSubscriber(Subscriber* subscriber)
+{
+    if (subscriber->state.load() == SUBSCRIBER_CONNECTING) {
+        struct pollfd pfd = { subscriber->fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, 0) <= 0)
+            return;
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(subscriber->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0) {
+            close(subscriber->fd);
+            subscriber->fd = -1;
+            subscriber->state.store(SUBSCRIBER_DOWN);
+            subscriber->retryAt = NowNanos() + publishReconnectNanos;
+            return;
+        }
+        SendHandshake(subscriber);
+    }
+
+    if (subscriber->state.load() == SUBSCRIBER_HANDSHAKE) {
+        char capability;
+        ssize_t n = recv(subscriber->fd, &capability, 1, MSG_DONTWAIT);
+        if (n == 1) {
+            subscriber->state.store(SUBSCRIBER_CONNECTED);
+            std::cout << "subscriber " << subscriber->name << " connected" << std::endl;
+        } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            DisconnectSubscriber(subscriber, "handshake rejected");
+        }
+    }
+}
+
+static void FlushSubscriber(Subscriber* subscriber)
+{
+    while (subscriber->flushed < subscriber->buffer.size()) {
+        ssize_t n = send(subscriber->fd, subscriber->buffer.data() + subscriber->flushed,
+            subscriber->buffer.size() - subscriber->flushed, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                DisconnectSubscriber(subscriber, strerror(errno));
+            break;
+        }
+        subscriber->flushed += (size_t) n;
+        subscriber->bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // drop the sent prefix once it dominates the buffer
+    if (subscriber->flushed == subscriber->buffer.size()) {
+        subscriber->buffer.clear();
+        subscriber->flushed = 0;
+    } else if (subscriber->flushed > subscriber->buffer.size() / 2) {
+        subscriber->buffer.erase(0, subscriber->flushed);
+        subscriber->flushed = 0;
+    }
+    subscriber->buffered.store((J) (subscriber->buffer.size() - subscriber->flushed), std::memory_order_relaxed);
+}
+
+static void PublishLoop()
+{
+    std::string payload, message;
+    J drainDeadline = 0;
+    for (;;) {
+        J now = NowNanos();
+        for (auto it = subscribers.begin(); it != subscribers.end(); it++) {
+            if ((*it)->state.load() == SUBSCRIBER_DOWN && now >= (*it)->retryAt)
+                ConnectSubscriber(*it);
+            if ((*it)->state.load() == SUBSCRIBER_CONNECTING || (*it)->state.load() == SUBSCRIBER_HANDSHAKE)
+                AdvanceSubscriber(*it);
+        }
+
+        while (publishQueue.pop(payload)) {
+            // async message header, little endian, uncompressed
+            std::string body = BuildCallBytes(publishFunction, payload);
+            I length = (I) (IPC_HEADER_SIZE + body.size());
+            message.assign("\1\0\0\0", 4);
+            message.append((const char*) &length, sizeof(I));
+            message += body;
+
+            for (auto it = subscribers.begin(); it != subscribers.end(); it++) {
+                Subscriber* subscriber = *it;
+                if (subscriber->state.load() != SUBSCRIBER_CONNECTED) {
+                    subscriber->dropped.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                if (subscriber->buffer.size() - subscriber->flushed + message.size() > publishBufferBytes) {
+                    std::cout << "subscriber " << subscriber->name << " evicted: more than " << publishBufferBytes << " bytes behind" << std::endl;
+                    subscriber->evictions.fetch_add(1, std::memory_order_relaxed);
+                    subscriber->dropped.fetch_add(1, std::memory_order_relaxed);
+                    DisconnectSubscriber(subscriber, "evicted");
+                    continue;
+                }
+                subscriber->buffer += message;
+                subscriber->messages.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        bool pending = false, unflushed = false;
+        for (auto it = subscribers.begin(); it != subscribers.end(); it++) {
+            if ((*it)->state.load() == SUBSCRIBER_CONNECTED)
+                FlushSubscriber(*it);
+            unflushed = unflushed || ((*it)->state.load() == SUBSCRIBER_CONNECTED && (*it)->flushed < (*it)->buffer.size());
+            pending = pending || unflushed || (*it)->state.load() == SUBSCRIBER_CONNECTING || (*it)->state.load() == SUBSCRIBER_HANDSHAKE;
+        }
+
+        if (!publishRunning.load() && publishQueue.empty()) {
+            if (drainDeadline == 0)
+                drainDeadline = NowNanos() + PUBLISH_DRAIN_NANOS;
+            if (!unflushed || NowNanos() >= drainDeadline)
+                break;
+        }
+
+        // retry partial writes and connects promptly, otherwise sleep until the next message
+        publishParker.Wait([&drainDeadline] { return !publishQueue.empty() || (!publishRunning.load() && drainDeadline == 0); },
+            std::chrono::microseconds(0), std::chrono::milliseconds(pending ? 1 : 100));
+    }
+}
+
+static void StopPublish()
+{
+    if (publishThread == nullptr)
+        return;
+    publishRunning.store(false);
+    publishParker.Unpark();
+    publishThread->join();
+    delete publishThread;
+    publishThread = nullptr;
+}
+
+static bool StartPublish(const FIX::Dictionary& defaults)
+{
+    if (publishThread != nullptr)
+        return true;
+
+    if (defaults.has("SubscriberFunction"))
+        publishFunction = defaults.getString("SubscriberFunction");
+    if (defaults.has("SubscriberCredentials"))
+        publishCredentials = defaults.getString("SubscriberCredentials");
+    if (defaults.has("SubscriberBufferBytes"))
+        publishBufferBytes = (size_t) defaults.getDouble("SubscriberBufferBytes");
+    if (defaults.has("SubscriberReconnectMillis"))
+        publishReconnectNanos = (J) defaults.getInt("SubscriberReconnectMillis") * 1000000;
+
+    std::stringstream stream(defaults.getString("Subscribers"));
+    std::string spec;
+    while (std::getline(stream, spec, ',')) {
+        if (spec.empty())
+            continue;
+        Subscriber* subscriber = new Subscriber;
+        subscriber->name = spec;
+        subscriber->nextAddress = 0;
+        subscriber->fd = -1;
+        subscriber->flushed = 0;
+        subscriber->retryAt = 0;
+        subscriber->state.store(SUBSCRIBER_DOWN);
+        subscriber->messages.store(0);
+        subscriber->bytes.store(0);
+        subscriber->buffered.store(0);
+        subscriber->dropped.store(0);
+        subscriber->evictions.store(0);
+        if (!ResolveSubscriber(spec, subscriber)) {
+            std::cout << "unable to resolve subscriber " << spec << std::endl;
+            delete subscriber;
+            return false;
+        }
+        subscribers.push_back(subscriber);
+    }
+
+    publishRunning.store(true);
+    publishThread = new std::thread(PublishLoop);
+    atexit(StopPublish);
+    return true;
+}
+
+static K SubscribersToTable()
+{
+    static const char* states[] = { "down", "connecting", "handshake", "connected" };
+    K names = ktn(KS, 7);
+    const char* columnNames[7] = { "subscriber", "state", "messages", "bytes", "buffered", "dropped", "evictions" };
+    for (int i = 0; i < 7; i++)
+        kS(names)[i] = ss((S) columnNames[i]);
+
+    J n = (J) subscribers.size();
+    K subscriber = ktn(KS, n), state = ktn(KS, n), messages = ktn(KJ, n), bytes = ktn(KJ, n);
+    K buffered = ktn(KJ, n), dropped = ktn(KJ, n), evictions = ktn(KJ, n);
+    for (J i = 0; i < n; i++) {
+        const Subscriber* it = subscribers[i];
+        kS(subscriber)[i] = ss((S) it->name.c_str());
+        kS(state)[i] = ss((S) states[it->state.load()]);
+        kJ(messages)[i] = it->messages.load();
+        kJ(bytes)[i] = it->bytes.load();
+        kJ(buffered)[i] = it->buffered.load();
+        kJ(dropped)[i] = it->dropped.load();
+        kJ(evictions)[i] = it->evictions.load();
+    }
+
+    return xT(xD(names, knk(7, subscriber, state, messages, bytes, buffered, dropped, evictions)));
+}
+
+#endif
@@ -0,0 +1,121 @@
+/* queue.h
+ * Lock-free queue used to hand work between the QuickFIX session threads, the
+ * q main thread and the adaptor's own background threads.
+ *
+ * MpscQueue is an unbounded multi-producer/single-consumer linked queue
+ * (Vyukov). push() is wait-free and may be called from any thread; pop() and
+ * empty() must only ever be called from the single consuming thread.
+ *
+ * Parker lets a background consumer spin for a bounded time and then sleep
+ * until a producer calls Unpark(). Producers only touch the mutex when the
+ * consumer has actually parked.
+ */
+
+#ifndef KDBFIX_QUEUE_H
+#define KDBFIX_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define CPU_RELAX() __builtin_ia32_pause()
+#else
+# define CPU_RELAX() std::atomic_signal_fence(std::memory_order_seq_cst)
+#endif
+
+template<typename T>
+class MpscQueue
+{
+    struct Node
+    {
+        std::atomic<Node*> next;
+        T value;
+        Node() : next(nullptr), value() {}
+    };
+
+    std::atomic<Node*> head;
+    Node* tail;
+
+    public:
+    MpscQueue() : head(new Node), tail(head.load()) {}
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    ~MpscQueue()
+    {
+        T discard;
+        while (pop(discard)) {}
+        delete tail;
+    }
+
+    void push(T value)
+    {
+        Node* node = new Node;
+        node->value = std::move(value);
+        Node* prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    bool pop(T& value)
+    {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+            return false;
+        value = std::move(next->value);
+        delete tail;
+        tail = next;
+        return true;
+    }
+
+    bool empty() const
+    {
+        return tail->next.load(std::memory_order_acquire) == nullptr;
+    }
+};
+
+class Parker
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<bool> parked;
+    bool signalled;
+
+    public:
+    Parker() : parked(false), signalled(false) {}
+
+    template<typename Ready>
+    void Wait(Ready ready, std::chrono::nanoseconds spin, std::chrono::milliseconds timeout)
+    {
+        auto deadline = std::chrono::steady_clock::now() + spin;
+        while (!ready()) {
+            if (std::chrono::steady_clock::now() >= deadline)
+                break;
+            CPU_RELAX();
+        }
+        if (ready())
+            return;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        parked.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready())
+            cv.wait_for(lock, timeout, [this] { return signalled; });
+        parked.store(false);
+        signalled = false;
+    }
+
+    void Unpark()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked.load()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            signalled = true;
+            cv.notify_one();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,103 @@
+/* routes.h
+ * MsgType routing of inbound messages to q callbacks.
+ *
+ * A route maps a MsgType, optionally for a single session, to the q function
+ * that receives it. Until a route is registered every message goes to
+ * .fix.onRecv as before; once any route exists, messages with no route are
+ * dropped in the adaptor before they are converted to q. The most specific
+ * route wins: session and MsgType, then session and *, then MsgType for all
+ * sessions, then * for all sessions.
+ *
+ * The table is copy-on-write: q replaces it whole under a mutex and the
+ * session threads take a snapshot of it with std::atomic_load, so a lookup
+ * never waits on an update being built. libstdc++ implements atomic_load on
+ * a shared_ptr with a short pooled lock of its own.
+ */
+
+#ifndef KDBFIX_ROUTES_H
+#define KDBFIX_ROUTES_H
+
+#include <quickfix/Message.h>
+#include <quickfix/SessionID.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <kx/k.h>
+
+// keyed on (session, MsgType); an empty session matches every session
+typedef std::map<std::pair<std::string, std::string>, std::string> RouteTable;
+
+static std::mutex routeMutex;
+static std::shared_ptr<const RouteTable> routeTable = std::make_shared<const RouteTable>();
+static std::atomic<J> routeDropped(0);
+
+static void SetRoute(const std::string& session, const std::string& msgType, const std::string& function)
+{
+    std::lock_guard<std::mutex> lock(routeMutex);
+    std::shared_ptr<RouteTable> updated = std::make_shared<RouteTable>(*std::atomic_load(&routeTable));
+    (*updated)[std::make_pair(session, msgType)] = function;
+    std::atomic_store(&routeTable, std::shared_ptr<const RouteTable>(updated));
+}
+
+static bool RemoveRoute(const std::string& session, const std::string& msgType)
+{
+    std::lock_guard<std::mutex> lock(routeMutex);
+    std::shared_ptr<RouteTable> updated = std::make_shared<RouteTable>(*std::atomic_load(&routeTable));
+    if (updated->erase(std::make_pair(session, msgType)) == 0)
+        return false;
+    std::atomic_store(&routeTable, std::shared_ptr<const RouteTable>(updated));
+    return true;
+}
+
+static bool RouteMessage(const FIX::Message& message, const FIX::SessionID& sessionID, std::string& function)
+{
+    std::shared_ptr<const RouteTable> table = std::atomic_load(&routeTable);
+    if (table->empty()) {
+        function = ".fix.onRecv";
+        return true;
+    }
+
+    const FIX::Header& header = message.getHeader();
+    std::string msgType = header.isSetField(35) ? header.getField(35) : "";
+    const std::string& session = sessionID.toString();
+    const std::pair<std::string, std::string> candidates[] = {
+        std::make_pair(session, msgType), std::make_pair(session, std::string("*")),
+        std::make_pair(std::string(), msgType), std::make_pair(std::string(), std::string("*")) };
+
+    for (int i = 0; i < 4; i++) {
+        auto found = table->find(candidates[i]);
+        if (found != table->end()) {
+            function = found->second;
+            return true;
+        }
+    }
+    routeDropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+static K RoutesToTable()
+{
+    std::shared_ptr<const RouteTable> table = std::atomic_load(&routeTable);
+
+    K names = ktn(KS, 3);
+    kS(names)[0] = ss((S) "session");
+    kS(names)[1] = ss((S) "msgType");
+    kS(names)[2] = ss((S) "function");
+
+    J n = (J) table->size();
+    K session = ktn(KS, n), msgType = ktn(KS, n), function = ktn(KS, n);
+    J i = 0;
+    for (auto it = table->begin(); it != table->end(); it++, i++) {
+        kS(session)[i] = ss((S) it->first.first.c_str());
+        kS(msgType)[i] = ss((S) it->first.second.c_str());
+        kS(function)[i] = ss((S) it->second.c_str());
+    }
+
+    return xT(xD(names, knk(3, session, msgType, function)));
+}
+
+#endif
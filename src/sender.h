@@ -0,0 +1,128 @@
+/* sender.h
+ * Asynchronous outbound send queue.
+ *
+ * In async mode .fix.send builds the FIX::Message on the q main thread and
+ * pushes it onto a lock-free queue; a dedicated sender thread, optionally
+ * pinned to a core, pops it and calls FIX::Session::sendToTarget. Session
+ * locking, sequence number assignment, store persistence and the socket write
+ * all happen on the sender thread.
+ *
+ * Each message is given an id which .fix.send returns. Failures (e.g. the
+ * session not being found) are always reported back to .fix.onEvent through
+ * the inbound delivery channel; successful sends are only reported when acks
+ * are requested.
+ */
+
+#ifndef KDBFIX_SENDER_H
+#define KDBFIX_SENDER_H
+
+#include <quickfix/Message.h>
+#include <quickfix/Session.h>
+#include <quickfix/SessionID.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include "delivery.h"
+#include "queue.h"
+#include "tuning.h"
+
+struct OutboundMessage
+{
+    FIX::Message* message;
+    J id;
+};
+
+static MpscQueue<OutboundMessage> sendQueue;
+static Parker sendParker;
+static std::thread* sendThread = nullptr;
+static std::atomic<bool> sendRunning(false);
+static bool sendAcks = false;
+static J sendNextId = 0;
+
+static std::string OutboundSession(const FIX::Message& message)
+{
+    const FIX::Header& header = message.getHeader();
+    if (!header.isSetField(8) || !header.isSetField(49) || !header.isSetField(56))
+        return "";
+    return FIX::SessionID(header.getField(8), header.getField(49), header.getField(56)).toString();
+}
+
+static void TransmitOutbound(const OutboundMessage& out)
+{
+    try {
+        if (FIX::Session::sendToTarget(*out.message)) {
+            if (sendAcks)
+                EnqueueEvent(".fix.onEvent", "sent", OutboundSession(*out.message), out.id, "");
+        } else {
+            EnqueueEvent(".fix.onEvent", "failed", OutboundSession(*out.message), out.id, "message not sent");
+        }
+    } catch (FIX::SessionNotFound&) {
+        EnqueueEvent(".fix.onEvent", "failed", OutboundSession(*out.message), out.id, "session not found");
+    } catch (std::exception& ex) {
+        EnqueueEvent(".fix.onEvent", "failed", OutboundSession(*out.message), out.id, ex.what());
+    }
+    delete out.message;
+}
+
+static void SendLoop(int cpu)
+{
+    if (cpu >= 0)
+        PinCurrentThread(cpu, "async sender");
+
+    OutboundMessage out;
+    for (;;) {
+        if (sendQueue.pop(out)) {
+            TransmitOutbound(out);
+            continue;
+        }
+        if (!sendRunning.load())
+            break;
+        sendParker.Wait([] { return !sendQueue.empty() || !sendRunning.load(); },
+            std::chrono::microseconds(50), std::chrono::milliseconds(100));
+    }
+}
+
+// drains anything still queued before returning
+static void StopAsyncSend()
+{
+    if (sendThread == nullptr)
+        return;
+    sendRunning.store(false);
+    sendParker.Unpark();
+    sendThread->join();
+    delete sendThread;
+    sendThread = nullptr;
+}
+
+static void StartAsyncSend(int cpu, bool acks)
+{
+    static bool registered = false;
+    StopAsyncSend();
+    sendAcks = acks;
+    sendRunning.store(true);
+    sendThread = new std::thread(SendLoop, cpu);
+
+    // the queue and parker are statics, so the thread must be gone before they are destroyed
+    if (!registered)
+        atexit(StopAsyncSend);
+    registered = true;
+}
+
+static bool AsyncSendEnabled()
+{
+    return sendThread != nullptr;
+}
+
+static J EnqueueOutbound(FIX::Message* message)
+{
+    OutboundMessage out = { message, ++sendNextId };
+    sendQueue.push(out);
+    sendParker.Unpark();
+    return out.id;
+}
+
+#endif
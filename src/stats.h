@@ -0,0 +1,126 @@
+/* stats.h
+ * Lock-free latency histogram. Samples are nanosecond durations recorded from
+ * any thread; the summary is built as a q dictionary on the q main thread.
+ *
+ * Buckets are log-linear: eight linear sub-buckets per power of two, so a
+ * reported percentile is within 12.5% of the true value.
+ */
+
+#ifndef KDBFIX_STATS_H
+#define KDBFIX_STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <kx/k.h>
+
+static inline J NowNanos()
+{
+    return (J) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class LatencyHistogram
+{
+    static const int SUB_BITS = 3;
+    static const int BUCKETS = 64 << SUB_BITS;
+
+    std::atomic<J> buckets[BUCKETS];
+    std::atomic<J> count;
+    std::atomic<J> sum;
+    std::atomic<J> min;
+    std::atomic<J> max;
+
+    static int BucketOf(J nanos)
+    {
+        if (nanos < (1 << SUB_BITS))
+            return (int) nanos;
+        int msb = 63 - __builtin_clzll((unsigned long long) nanos);
+        int sub = (int) ((nanos >> (msb - SUB_BITS)) & ((1 << SUB_BITS) - 1));
+        return ((msb - SUB_BITS + 1) << SUB_BITS) | sub;
+    }
+
+    static J UpperBoundOf(int bucket)
+    {
+        if (bucket < (1 << SUB_BITS))
+            return bucket;
+        int msb = (bucket >> SUB_BITS) + SUB_BITS - 1;
+        J sub = bucket & ((1 << SUB_BITS) - 1);
+        return ((((J) 1 << SUB_BITS) | sub) << (msb - SUB_BITS)) + ((J) 1 << (msb - SUB_BITS)) - 1;
+    }
+
+    J Percentile(double p) const
+    {
+        J total = count.load(std::memory_order_relaxed);
+        if (total == 0)
+            return nj;
+        J rank = (J) (p * total);
+        if (rank >= total)
+            rank = total - 1;
+        J seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += buckets[b].load(std::memory_order_relaxed);
+            if (seen > rank)
+                return std::min(UpperBoundOf(b), max.load(std::memory_order_relaxed));
+        }
+        return max.load(std::memory_order_relaxed);
+    }
+
+    public:
+    LatencyHistogram() { Reset(); }
+
+    void Reset()
+    {
+        for (int b = 0; b < BUCKETS; b++)
+            buckets[b].store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        min.store(wj, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+
+    void Record(J nanos)
+    {
+        if (nanos < 0)
+            nanos = 0;
+        buckets[BucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(nanos, std::memory_order_relaxed);
+        J seen = min.load(std::memory_order_relaxed);
+        while (nanos < seen && !min.compare_exchange_weak(seen, nanos, std::memory_order_relaxed)) {}
+        seen = max.load(std::memory_order_relaxed);
+        while (nanos > seen && !max.compare_exchange_weak(seen, nanos, std::memory_order_relaxed)) {}
+    }
+
+    J Count() const { return count.load(std::memory_order_relaxed); }
+
+    // `count`min`max`mean`p50`p90`p99`p999 - durations are returned as timespans
+    K ToDictionary() const
+    {
+        J n = count.load(std::memory_order_relaxed);
+        K keys = ktn(KS, 8);
+        K values = ktn(0, 8);
+
+        kS(keys)[0] = ss((S) "count");
+        kS(keys)[1] = ss((S) "min");
+        kS(keys)[2] = ss((S) "max");
+        kS(keys)[3] = ss((S) "mean");
+        kS(keys)[4] = ss((S) "p50");
+        kS(keys)[5] = ss((S) "p90");
+        kS(keys)[6] = ss((S) "p99");
+        kS(keys)[7] = ss((S) "p999");
+
+        kK(values)[0] = kj(n);
+        kK(values)[1] = ktj(-KN, n ? min.load(std::memory_order_relaxed) : nj);
+        kK(values)[2] = ktj(-KN, n ? max.load(std::memory_order_relaxed) : nj);
+        kK(values)[3] = ktj(-KN, n ? sum.load(std::memory_order_relaxed) / n : nj);
+        kK(values)[4] = ktj(-KN, Percentile(0.5));
+        kK(values)[5] = ktj(-KN, Percentile(0.9));
+        kK(values)[6] = ktj(-KN, Percentile(0.99));
+        kK(values)[7] = ktj(-KN, Percentile(0.999));
+
+        return xD(keys, values);
+    }
+};
+
+#endif
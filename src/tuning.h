@@ -0,0 +1,91 @@
+/* tuning.h
+ * Per-session low-latency settings, read from the session settings file:
+ *
+ *   CpuAffinity=<core>       pin the session's socket thread to one core
+ *
+ * ThreadedSocketInitiator/ThreadedSocketAcceptor create their own threads, so
+ * the settings are applied lazily from the first callback QuickFIX makes on
+ * each session thread. PinCurrentThread is also used by the adaptor's own
+ * background threads.
+ */
+
+#ifndef KDBFIX_TUNING_H
+#define KDBFIX_TUNING_H
+
+#include <quickfix/SessionSettings.h>
+#include <quickfix/SessionID.h>
+
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <cstring>
+
+#ifdef __linux__
+# include <pthread.h>
+# include <sched.h>
+#endif
+
+struct SessionTuning
+{
+    int cpu;
+};
+
+static std::mutex sessionTuningMutex;
+static std::map<FIX::SessionID, SessionTuning> sessionTuning;
+
+static void LoadSessionTuning(const FIX::SessionSettings& settings)
+{
+    std::set<FIX::SessionID> sessions = settings.getSessions();
+    for (auto it = sessions.begin(); it != sessions.end(); it++) {
+        try {
+            const FIX::Dictionary& dict = settings.get(*it);
+            SessionTuning tuning = { -1 };
+            if (dict.has("CpuAffinity"))
+                tuning.cpu = dict.getInt("CpuAffinity");
+            if (tuning.cpu < 0)
+                continue;
+
+            std::lock_guard<std::mutex> lock(sessionTuningMutex);
+            sessionTuning[*it] = tuning;
+        } catch (std::exception& ex) {
+            std::cout << "LoadSessionTuning - ignoring settings for " << it->toString() << ": " << ex.what() << std::endl;
+        }
+    }
+}
+
+static void PinCurrentThread(int cpu, const std::string& name)
+{
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (err != 0)
+        std::cout << "unable to pin " << name << " to cpu " << cpu << ": " << strerror(err) << std::endl;
+#else
+    std::cout << "unable to pin " << name << " - cpu affinity is only supported on Linux" << std::endl;
+#endif
+}
+
+static void ApplySessionTuning(const FIX::SessionID& sessionID)
+{
+    static thread_local bool applied = false;
+    if (applied)
+        return;
+    applied = true;
+
+    SessionTuning tuning;
+    {
+        std::lock_guard<std::mutex> lock(sessionTuningMutex);
+        auto found = sessionTuning.find(sessionID);
+        if (found == sessionTuning.end())
+            return;
+        tuning = found->second;
+    }
+
+    PinCurrentThread(tuning.cpu, sessionID.toString());
+}
+
+#endif